@@ -0,0 +1,212 @@
+#include "bench.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// sorts samples in place. percentiles are nearest rank; stddev is the sample
+// standard deviation, 0 for a single sample.
+void benchSummarize(double *samples, int count, benchStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->count = count;
+  if (count < 1) {
+    return;
+  }
+  qsort(samples, count, sizeof(double), compareDoubles);
+  stats->min = samples[0];
+  stats->median = count % 2 ? samples[count / 2]
+                            : 0.5 * (samples[count / 2 - 1] +
+                                     samples[count / 2]);
+  stats->p95 = samples[(int)ceil(0.95 * count) - 1];
+
+  double sum = 0.0, squares = 0.0;
+  for (int i = 0; i < count; i++) {
+    sum += samples[i];
+  }
+  stats->mean = sum / count;
+  for (int i = 0; i < count; i++) {
+    squares += (samples[i] - stats->mean) * (samples[i] - stats->mean);
+  }
+  stats->stddev = count > 1 ? sqrt(squares / (count - 1)) : 0.0;
+}
+
+//-----------------records-----------------
+static const char *header = "device,driver,kernel,n,warmup,reps,min_ms,"
+                            "median_ms,p95_ms,mean_ms,stddev_ms,gflops,gbps,"
+                            "call_ms";
+
+// path ending in .csv writes CSV with a header, anything else JSON lines.
+// returns 0, or 1 if the file cannot be created.
+int benchOpen(benchWriter *w, const char *path) {
+  size_t length = strlen(path);
+  w->csv = length >= 4 && !strcmp(path + length - 4, ".csv");
+  w->file = fopen(path, "w");
+  if (!w->file) {
+    fprintf(stderr, "cannot write %s\n", path);
+    return 1;
+  }
+  if (w->csv) {
+    fprintf(w->file, "%s\n", header);
+  }
+  return 0;
+}
+
+// a quoted string, escaped for JSON or for CSV
+void benchString(FILE *file, const char *text, int csv) {
+  fputc('"', file);
+  for (const char *c = text; *c; c++) {
+    if (csv && *c == '"') {
+      fputs("\"\"", file);
+    } else if (!csv && (*c == '"' || *c == '\\')) {
+      fprintf(file, "\\%c", *c);
+    } else if ((unsigned char)*c >= ' ') {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+void benchWrite(benchWriter *w, const benchRecord *r) {
+  const char *names[] = {"device", "driver", "kernel"};
+  const char *strings[] = {r->device, r->driver, r->kernel};
+  const char *keys[] = {"n",         "warmup",    "reps",   "min_ms",
+                        "median_ms", "p95_ms",    "mean_ms", "stddev_ms",
+                        "gflops",    "gbps",      "call_ms"};
+  const double values[] = {r->n,
+                           r->warmup,
+                           r->stats.count,
+                           r->stats.min * 1e3,
+                           r->stats.median * 1e3,
+                           r->stats.p95 * 1e3,
+                           r->stats.mean * 1e3,
+                           r->stats.stddev * 1e3,
+                           r->gflops,
+                           r->gbps,
+                           r->call * 1e3};
+  if (!w->file) {
+    return;
+  }
+  fputs(w->csv ? "" : "{", w->file);
+  for (int s = 0; s < 3; s++) {
+    if (!w->csv) {
+      fprintf(w->file, "%s\"%s\": ", s ? ", " : "", names[s]);
+    } else if (s) {
+      fputc(',', w->file);
+    }
+    benchString(w->file, strings[s], w->csv);
+  }
+  for (int v = 0; v < 11; v++) {
+    if (w->csv) {
+      fprintf(w->file, ",%.9g", values[v]);
+    } else {
+      fprintf(w->file, ", \"%s\": %.9g", keys[v], values[v]);
+    }
+  }
+  fputs(w->csv ? "\n" : "}\n", w->file);
+  fflush(w->file);
+}
+
+void benchClose(benchWriter *w) {
+  if (w->file) {
+    fclose(w->file);
+    w->file = NULL;
+  }
+}
+
+// the string starting at a quote into out, undoing either escaping. returns
+// the character after the closing quote.
+static const char *readString(const char *p, char *out, size_t size,
+                              int csv) {
+  size_t length = 0;
+  for (p++; *p; p++) {
+    if (*p == '"' && !(csv && p[1] == '"')) {
+      p++;
+      break;
+    }
+    if (*p == '"' || (!csv && *p == '\\' && p[1])) {
+      p++;
+    }
+    if (length + 1 < size) {
+      out[length++] = *p;
+    }
+  }
+  out[length] = '\0';
+  return p;
+}
+
+// fields of a CSV line or values of a flat JSON object in record order
+static int parseRecord(const char *line, benchRecord *r) {
+  char *strings[] = {r->device, r->driver, r->kernel};
+  double values[11];
+  int csv = *line != '{';
+  const char *p = line + !csv;
+  memset(r, 0, sizeof(*r));
+  for (int f = 0; f < 14; f++) {
+    // skip to the value: past a comma in CSV, past "key": in JSON
+    while (*p == ' ' || *p == ',') {
+      p++;
+    }
+    if (!csv) {
+      if (*p != '"' || !(p = strchr(p + 1, '"')) || !(p = strchr(p, ':'))) {
+        return 0;
+      }
+      for (p++; *p == ' '; p++) {
+      }
+    }
+    if (f < 3) {
+      if (*p != '"') {
+        return 0;
+      }
+      p = readString(p, strings[f], BENCH_FIELD, csv);
+    } else {
+      char *end;
+      values[f - 3] = strtod(p, &end);
+      if (end == p) {
+        return 0;
+      }
+      p = end;
+    }
+  }
+  r->n = (int)values[0];
+  r->warmup = (int)values[1];
+  r->stats.count = (int)values[2];
+  r->stats.min = values[3] * 1e-3;
+  r->stats.median = values[4] * 1e-3;
+  r->stats.p95 = values[5] * 1e-3;
+  r->stats.mean = values[6] * 1e-3;
+  r->stats.stddev = values[7] * 1e-3;
+  r->gflops = values[8];
+  r->gbps = values[9];
+  r->call = values[10] * 1e-3;
+  return 1;
+}
+
+// every record in a file written by benchWrite, in either format, into a
+// malloc'd array. returns the count, or -1 if the file cannot be read.
+int benchRead(const char *path, benchRecord **records) {
+  char line[1024];
+  int count = 0, capacity = 0;
+  FILE *file = fopen(path, "r");
+  *records = NULL;
+  if (!file) {
+    fprintf(stderr, "cannot read %s\n", path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), file)) {
+    if (!strncmp(line, header, strlen("device,"))) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity ? 2 * capacity : 64;
+      *records =
+          (benchRecord *)realloc(*records, capacity * sizeof(benchRecord));
+    }
+    count += parseRecord(line, &(*records)[count]);
+  }
+  fclose(file);
+  return count;
+}
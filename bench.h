@@ -0,0 +1,38 @@
+// summary statistics of repeated timings, and benchmark records written as
+// JSON lines or CSV for tools like bench-compare
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdio.h>
+
+#define BENCH_FIELD 128 // longest device, driver or kernel name kept
+
+typedef struct {
+  int count;
+  double min, median, p95, mean, stddev; // same unit as the samples
+} benchStats;
+
+// one kernel at one size. stats & call are in seconds, rates at the median
+typedef struct {
+  char device[BENCH_FIELD], driver[BENCH_FIELD], kernel[BENCH_FIELD];
+  int n, warmup;
+  benchStats stats;
+  double gflops, gbps;
+  double call; // median wall time of the whole call, copies included
+} benchRecord;
+
+typedef struct {
+  FILE *file;
+  int csv;
+} benchWriter;
+
+void benchSummarize(double *samples, int count, benchStats *stats);
+
+int benchOpen(benchWriter *w, const char *path);
+void benchWrite(benchWriter *w, const benchRecord *r);
+void benchClose(benchWriter *w);
+int benchRead(const char *path, benchRecord **records);
+void benchString(FILE *file, const char *text, int csv);
+
+#endif
@@ -0,0 +1,143 @@
+// bench-compare <baseline> <candidate>: matches the records of two matrixOp
+// bench --out files by device, kernel & size and flags the ones that got
+// slower, by Welch's t-test on the mean & stddev of their kernel times.
+// exits 1 when anything regressed, so a change can be gated on it.
+
+#include "bench.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPARE_ALPHA 0.05     // one-sided significance of a slowdown
+#define COMPARE_THRESHOLD 0.02 // slowdowns smaller than 2% are ignored
+#define BETA_ITERATIONS 200
+#define BETA_EPSILON 1e-12
+
+// continued fraction for the incomplete beta function (modified Lentz)
+static double betaFraction(double a, double b, double x) {
+  double c = 1.0, d = 1.0 - (a + b) * x / (a + 1.0);
+  d = 1.0 / (fabs(d) < 1e-300 ? 1e-300 : d);
+  double h = d;
+  for (int m = 1; m <= BETA_ITERATIONS; m++) {
+    for (int odd = 0; odd < 2; odd++) {
+      double term = odd ? -(a + m) * (a + b + m) * x /
+                              ((a + 2 * m) * (a + 2 * m + 1))
+                        : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+      d = 1.0 + term * d;
+      d = 1.0 / (fabs(d) < 1e-300 ? 1e-300 : d);
+      c = 1.0 + term / c;
+      c = fabs(c) < 1e-300 ? 1e-300 : c;
+      h *= c * d;
+      if (odd && fabs(c * d - 1.0) < BETA_EPSILON) {
+        return h;
+      }
+    }
+  }
+  return h;
+}
+
+// regularized incomplete beta I_x(a, b)
+static double incompleteBeta(double a, double b, double x) {
+  if (x <= 0.0) {
+    return 0.0;
+  }
+  if (x >= 1.0) {
+    return 1.0;
+  }
+  double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) +
+                     b * log(1.0 - x));
+  if (x < (a + 1.0) / (a + b + 2.0)) {
+    return front * betaFraction(a, b, x) / a;
+  }
+  return 1.0 - front * betaFraction(b, a, 1.0 - x) / b;
+}
+
+// one-sided p-value that the candidate's mean time is no higher than the
+// baseline's, from the summary statistics alone
+static double welchSlower(const benchStats *base, const benchStats *cand) {
+  double v1 = base->stddev * base->stddev / base->count;
+  double v2 = cand->stddev * cand->stddev / cand->count;
+  double diff = cand->mean - base->mean;
+  if (v1 + v2 == 0.0) {
+    return diff > 0.0 ? 0.0 : 1.0;
+  }
+  double t = diff / sqrt(v1 + v2);
+  double df = (v1 + v2) * (v1 + v2) /
+              ((base->count > 1 ? v1 * v1 / (base->count - 1) : 0.0) +
+               (cand->count > 1 ? v2 * v2 / (cand->count - 1) : 0.0));
+  double tail = 0.5 * incompleteBeta(0.5 * df, 0.5, df / (df + t * t));
+  return t > 0.0 ? tail : 1.0 - tail;
+}
+
+static const benchRecord *findRecord(const benchRecord *records, int count,
+                                     const benchRecord *key) {
+  for (int i = 0; i < count; i++) {
+    if (records[i].n == key->n && !strcmp(records[i].kernel, key->kernel) &&
+        !strcmp(records[i].device, key->device)) {
+      return &records[i];
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  double alpha = COMPARE_ALPHA, threshold = COMPARE_THRESHOLD;
+  const char *paths[2] = {NULL, NULL};
+  int numPaths = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--alpha") && i + 1 < argc) {
+      alpha = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else if (numPaths < 2) {
+      paths[numPaths++] = argv[i];
+    }
+  }
+  if (numPaths < 2) {
+    fprintf(stderr, "usage: bench-compare [--alpha p] [--threshold fraction] "
+                    "<baseline> <candidate>\n");
+    return 2;
+  }
+
+  benchRecord *base, *cand;
+  int numBase = benchRead(paths[0], &base);
+  int numCand = benchRead(paths[1], &cand);
+  if (numBase < 0 || numCand < 0) {
+    free(base);
+    free(cand);
+    return 2;
+  }
+
+  int regressions = 0, compared = 0;
+  printf("%-24s %-6s %6s %10s %10s %8s %9s  %s\n", "device", "kernel", "n",
+         "base ms", "new ms", "change", "p", "verdict");
+  for (int i = 0; i < numCand; i++) {
+    const benchRecord *c = &cand[i];
+    const benchRecord *b = findRecord(base, numBase, c);
+    if (!b) {
+      printf("%-24.24s %-6s %6d %10s %10.3f %8s %9s  new\n", c->device,
+             c->kernel, c->n, "-", c->stats.mean * 1e3, "-", "-");
+      continue;
+    }
+    compared++;
+    double change = c->stats.mean / b->stats.mean - 1.0;
+    double slower = welchSlower(&b->stats, &c->stats);
+    double faster = welchSlower(&c->stats, &b->stats);
+    const char *verdict = "same";
+    if (change > threshold && slower < alpha) {
+      verdict = "REGRESSION";
+      regressions++;
+    } else if (-change > threshold && faster < alpha) {
+      verdict = "faster";
+    }
+    printf("%-24.24s %-6s %6d %10.3f %10.3f %+7.1f%% %9.2e  %s\n", c->device,
+           c->kernel, c->n, b->stats.mean * 1e3, c->stats.mean * 1e3,
+           100.0 * change, change > 0.0 ? slower : faster, verdict);
+  }
+  printf("%d compared, %d regressed (alpha %g, threshold %g%%)\n", compared,
+         regressions, alpha, 100.0 * threshold);
+  free(base);
+  free(cand);
+  return regressions > 0;
+}
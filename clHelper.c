@@ -1,6 +1,14 @@
 #include "clHelper.h"
+#include "deviceSelect.h"
+#include "parallel.h"
+#include "philox.h"
+#include "runtime.h"
+#include "timer.h"
+#include "trace.h"
 #include <CL/opencl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 //-----------------host helper stuff-----------------
@@ -147,60 +155,101 @@ const char *getErrorString(cl_int error) {
   }
 }
 
-// real function to check error message and print success or fail
-void checkErr(cl_int error, char *success) {
+// report a failed call on stderr and hand its code back. checkErr in the
+// header only calls this on failure unless VERBOSE is set.
+cl_int reportErr(cl_int error, const char *what) {
   if (error != CL_SUCCESS) {
-    printf("%s\n", getErrorString(error));
-    exit(0);
+    fprintf(stderr, "%s failed: %s\n", what, getErrorString(error));
   } else {
-    if (VERBOSE) {
-      printf("%s\n", success);
-    } else {
-      printf(".");
-    }
+    printf("%s\n", what);
   }
+  return error;
 }
 
-// random double between min and max
-double randdouble(double min, double max) {
-  return (((double)rand() * (max - min)) / ((double)RAND_MAX + min));
+// errors worth retrying with less memory: smaller panels or the CPU
+int isResourceError(cl_int error) {
+  return error == CL_OUT_OF_RESOURCES ||
+         error == CL_MEM_OBJECT_ALLOCATION_FAILURE ||
+         error == CL_OUT_OF_HOST_MEMORY || error == CL_INVALID_BUFFER_SIZE;
 }
 
-// initialize host inputs
-void initHost(double *hA, double *hB) {
-  for (int i = 0; i < N * N; i++) {
-    hA[i] = (randdouble(-10.0, 10.0));
-    hB[i] = randdouble(-10.0, 10.0);
-  }
+// initialize host inputs, A & B as streams 0 & 1 of the seed
+void initHost(double *hA, double *hB, int n) {
+  size_t count = (size_t)n * n;
+  double start = traceBegin();
+  randomFill(hA, count, -10.0, 10.0, defaultSeed(), 0, defaultThreads());
+  randomFill(hB, count, -10.0, 10.0, defaultSeed(), 1, defaultThreads());
+  traceEnd("initHost", start);
 }
 
 //-----------------configure environment-----------------
-// get platform & device
-void getPlatformDevice(cl_platform_id *platformID, cl_device_id *deviceID) {
-  cl_uint retNumDevices;
-  cl_uint retNumPlatforms;
-  cl_int err = clGetPlatformIDs(1, platformID, &retNumPlatforms);
-  checkErr(err, "got platform");
-  err =
-      clGetDeviceIDs(*platformID, CL_DEVICE_TYPE_GPU, 0, NULL, &retNumDevices);
-  err = clGetDeviceIDs(*platformID, CL_DEVICE_TYPE_GPU, retNumDevices, deviceID,
-                       NULL);
-  checkErr(err, "got device");
+// get platform & device, chosen by --device or CLMM_DEVICE (see
+// deviceSelect.c)
+cl_int getPlatformDevice(cl_platform_id *platformID, cl_device_id *deviceID) {
+  return selectDevice(NULL, platformID, deviceID);
+}
+
+// get every device on every platform. *platforms gets the platform of each
+// device; both arrays are malloc'd and the device count is returned.
+cl_uint getAllDevices(cl_platform_id **platforms, cl_device_id **devices) {
+  cl_uint numPlatforms = 0;
+  cl_uint total = 0;
+  // no platform at all (no ICD installed) is reported as zero devices
+  cl_int err = clGetPlatformIDs(0, NULL, &numPlatforms);
+  if (err != CL_SUCCESS) {
+    numPlatforms = 0;
+  }
+  cl_platform_id *platformIDs =
+      (cl_platform_id *)malloc(numPlatforms * sizeof(cl_platform_id));
+  if (numPlatforms > 0 &&
+      clGetPlatformIDs(numPlatforms, platformIDs, NULL) != CL_SUCCESS) {
+    numPlatforms = 0;
+  }
+
+  cl_uint *counts = (cl_uint *)calloc(numPlatforms, sizeof(cl_uint));
+  for (cl_uint p = 0; p < numPlatforms; p++) {
+    // a platform without devices reports CL_DEVICE_NOT_FOUND, not an error
+    if (clGetDeviceIDs(platformIDs[p], CL_DEVICE_TYPE_ALL, 0, NULL,
+                       &counts[p]) != CL_SUCCESS) {
+      counts[p] = 0;
+    }
+    total += counts[p];
+  }
+
+  *platforms = (cl_platform_id *)malloc(total * sizeof(cl_platform_id));
+  *devices = (cl_device_id *)malloc(total * sizeof(cl_device_id));
+  cl_uint next = 0;
+  for (cl_uint p = 0; p < numPlatforms; p++) {
+    if (counts[p] == 0 ||
+        clGetDeviceIDs(platformIDs[p], CL_DEVICE_TYPE_ALL, counts[p],
+                       *devices + next, NULL) != CL_SUCCESS) {
+      continue;
+    }
+    for (cl_uint d = 0; d < counts[p]; d++) {
+      (*platforms)[next + d] = platformIDs[p];
+    }
+    next += counts[p];
+  }
+  free(counts);
+  free(platformIDs);
+  return next;
 }
 
 // create context
-void createContext(cl_context *context, cl_platform_id *platformID,
-                   cl_device_id *deviceID) {
+cl_int createContext(cl_context *context, cl_platform_id *platformID,
+                     cl_device_id *deviceID) {
   cl_context_properties props[3] = {CL_CONTEXT_PLATFORM,
                                     (cl_context_properties)*platformID, 0};
   cl_int err;
+  double start = traceBegin();
   *context = clCreateContext(props, 1, deviceID, NULL, NULL, &err);
-  checkErr(err, "created context");
+  traceEnd("createContext", start);
+  return checkErr(err, "created context");
 }
 
 // create command queue
-void createQueue(cl_command_queue *commandQueue, cl_context *context,
-                 cl_device_id *deviceID, int outOfOrder, int profiling) {
+cl_int createQueue(cl_command_queue *commandQueue, cl_context *context,
+                   cl_device_id *deviceID, int outOfOrder, int profiling) {
   cl_int err;
   cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, 0, 0};
   if (outOfOrder) {
@@ -211,15 +260,16 @@ void createQueue(cl_command_queue *commandQueue, cl_context *context,
   }
   *commandQueue =
       clCreateCommandQueueWithProperties(*context, *deviceID, props, &err);
-  checkErr(err, "created command queue");
+  return checkErr(err, "created command queue");
 }
 //------------------------------------------------------------
-// load kernel from file
+// load kernel from file, NULL if it cannot be read
 char *kernelFromFile(size_t *kernelSize, char *filename) {
+  double start = traceBegin();
   FILE *kernelFile = fopen(filename, "rb");
   if (!kernelFile) {
-    fprintf(stderr, "kernel file not found.\n");
-    exit(-1);
+    fprintf(stderr, "kernel file %s not found.\n", filename);
+    return NULL;
   }
   // get size
   fseek(kernelFile, 0, SEEK_END);
@@ -228,101 +278,177 @@ char *kernelFromFile(size_t *kernelSize, char *filename) {
 
   // read string
   char *source = (char *)malloc((size + 1) * sizeof(char));
-  fread(source, 1, size * sizeof(char), kernelFile);
+  size = fread(source, 1, size * sizeof(char), kernelFile);
+  source[size] = '\0';
   fclose(kernelFile);
-  printf("loaded file %s\n", filename);
+  if (VERBOSE) {
+    printf("loaded file %s\n", filename);
+  }
 
   *kernelSize = size;
+  traceEnd("kernelFromFile", start);
   return source;
 }
 
 // compile program from source
-void createProgramFromSource(cl_program *program, cl_context *context,
-                             const char *kernelSource, size_t *kernelSize) {
+cl_int createProgramFromSource(cl_program *program, cl_context *context,
+                               const char *kernelSource, size_t *kernelSize) {
   cl_int err;
   *program =
       clCreateProgramWithSource(*context, 1, &kernelSource, kernelSize, &err);
-  checkErr(err, "created program from source");
+  return checkErr(err, "created program from source");
 }
 
-// build program
-void buildProgram(cl_program *program, cl_device_id *deviceID) {
+static __thread double lastBuild; // seconds, per thread like the caller
+
+// build program for one device. the log is printed whenever it has anything
+// in it, since besides errors it is where drivers report spills & resources.
+cl_int buildProgram(cl_program *program, cl_device_id *deviceID) {
   cl_int err;
+  double start = wallTime();
   err = clBuildProgram(*program, 1, deviceID, NULL, NULL, NULL);
-  checkErr(err, "built program");
-  // Check for compilation errors
-  // size_t logSize;
-  // err = clGetProgramBuildInfo(*program, *deviceID, CL_PROGRAM_BUILD_LOG, 0,
-  //                             NULL, &logSize);
-  // checkErr(err, "build passed");
-  // char *messages = (char *)malloc((1 + logSize) * sizeof(char));
-  // err = clGetProgramBuildInfo(*program, *deviceID, CL_PROGRAM_BUILD_LOG,
-  //                             logSize, messages, NULL);
-  // checkErr(err, "build passed");
-  // messages[logSize] = '\0';
-  // if (logSize > 10) {
-  //   printf("## Compiler message: %s\n", messages);
-  // }
-  // free(messages);
+  lastBuild = wallTime() - start;
+  traceEnd("buildProgram", start);
+
+  size_t logSize = 0;
+  clGetProgramBuildInfo(*program, *deviceID, CL_PROGRAM_BUILD_LOG, 0, NULL,
+                        &logSize);
+  char *messages = logSize > 1 ? (char *)malloc(logSize + 1) : NULL;
+  if (messages && clGetProgramBuildInfo(*program, *deviceID,
+                                        CL_PROGRAM_BUILD_LOG, logSize,
+                                        messages, NULL) == CL_SUCCESS) {
+    messages[logSize] = '\0';
+    while (logSize > 0 && (unsigned char)messages[logSize - 1] <= ' ') {
+      messages[--logSize] = '\0';
+    }
+    if (logSize > 0) {
+      fprintf(stderr, "## build log (%.1f ms):\n%s\n", lastBuild * 1e3,
+              messages);
+    }
+  }
+  free(messages);
+  return checkErr(err, "built program");
 }
 
-void createBuffer(cl_mem *deviceBuffer, size_t size, int direction,
-                  cl_context *context) {
+// seconds the calling thread's last buildProgram took
+double lastBuildTime(void) { return lastBuild; }
+
+cl_int createBuffer(cl_mem *deviceBuffer, size_t size, int direction,
+                    cl_context *context) {
   cl_int err;
   *deviceBuffer = clCreateBuffer(
       *context, direction, size, NULL,
       &err); // for flags: direction will be 1(output) or 2(input).
-  checkErr(err, "created buffer");
+  return checkErr(err, "created buffer");
 }
 
 // copy host to device
-void writeBuffer(cl_mem dest, double *source, cl_command_queue *commandQueue) {
+cl_int writeBuffer(cl_mem dest, const double *source, size_t size,
+                   cl_command_queue *commandQueue) {
+  cl_event traced;
   cl_int err;
-  err = clEnqueueWriteBuffer(*commandQueue, dest, CL_TRUE, 0,
-                             N * N * sizeof(*source), source, 0, NULL, NULL);
-  checkErr(err, "copied host to device");
+  err = clEnqueueWriteBuffer(*commandQueue, dest, CL_TRUE, 0, size, source, 0,
+                             NULL, traceEvent(&traced));
+  traceTake(traced, "write");
+  return checkErr(err, "copied host to device");
 }
 
 // create kernel
-void createKernel(cl_kernel *kernel, cl_program *program, char *funcName) {
+cl_int createKernel(cl_kernel *kernel, cl_program *program, char *funcName) {
   cl_int err;
   *kernel = clCreateKernel(*program, funcName, &err);
-  checkErr(err, "created kernel");
+  return checkErr(err, "created kernel");
 }
 
-void setArgs(cl_kernel *kernel, cl_mem dA, cl_mem dB, cl_mem dC) {
+cl_int setArgs(cl_kernel *kernel, int n, cl_mem dA, cl_mem dB, cl_mem dC) {
   cl_int err;
-  int n = N;
-  err = clSetKernelArg(*kernel, 0, sizeof(int), (void *)&n);
-  checkErr(err, "set arg 0");
-  err = clSetKernelArg(*kernel, 1, sizeof(cl_mem), (void *)&dA);
-  checkErr(err, "set arg 1");
-  err = clSetKernelArg(*kernel, 2, sizeof(cl_mem), (void *)&dB);
-  checkErr(err, "set arg 2");
-  err = clSetKernelArg(*kernel, 3, sizeof(cl_mem), (void *)&dC);
-  checkErr(err, "set arg 3");
+  if ((err = clSetKernelArg(*kernel, 0, sizeof(int), (void *)&n)) ||
+      (err = clSetKernelArg(*kernel, 1, sizeof(cl_mem), (void *)&dA)) ||
+      (err = clSetKernelArg(*kernel, 2, sizeof(cl_mem), (void *)&dB)) ||
+      (err = clSetKernelArg(*kernel, 3, sizeof(cl_mem), (void *)&dC))) {
+    return checkErr(err, "set args");
+  }
+  return CL_SUCCESS;
 }
 
-void execKernel(cl_command_queue commandQueue, cl_kernel kernel,
-                cl_event *event) {
-  const int tile = 16; // solve the matrix in groups of 256
-  const size_t local[2] = {tile, tile};
-  const size_t global[2] = {N, N};
+// query the work-group limits & memory the compiler gave a kernel
+cl_int kernelInfo(cl_kernel kernel, cl_device_id device, kernelResources *r) {
   cl_int err;
-  err = clEnqueueNDRangeKernel(
-      commandQueue, kernel, 2, NULL, global, local, 0, NULL,
-      event); // 2D kernel with global /local work size set
-  checkErr(err, "kernel executed");
-  err = clWaitForEvents(1, event);
-  checkErr(err, "finished execution");
+  memset(r, 0, sizeof(*r));
+  if ((err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                      sizeof(r->workGroupSize),
+                                      &r->workGroupSize, NULL)) ||
+      (err = clGetKernelWorkGroupInfo(
+           kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+           sizeof(r->preferredMultiple), &r->preferredMultiple, NULL)) ||
+      (err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_LOCAL_MEM_SIZE,
+                                      sizeof(r->localMem), &r->localMem,
+                                      NULL)) ||
+      (err = clGetKernelWorkGroupInfo(kernel, device,
+                                      CL_KERNEL_PRIVATE_MEM_SIZE,
+                                      sizeof(r->privateMem), &r->privateMem,
+                                      NULL)) ||
+      (err = clGetKernelWorkGroupInfo(kernel, device,
+                                      CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+                                      sizeof(r->compiled), r->compiled,
+                                      NULL))) {
+    return checkErr(err, "queried kernel resources");
+  }
+  return CL_SUCCESS;
+}
+
+// local size for a rows x cols launch, or NULL to leave it to the driver. a
+// kernel compiled for one size gets it, and NULL if the grid is not whole
+// groups of it. otherwise rows, which are contiguous in column-major C, get
+// the preferred multiple (at least LOCAL_ROWS) & cols the rest of up to
+// LOCAL_MAX work-items, halved until each divides its side.
+const size_t *kernelLocal(const kernelResources *r, size_t rows, size_t cols,
+                          size_t local[2]) {
+  if (r->compiled[0]) {
+    local[0] = r->compiled[0];
+    local[1] = r->compiled[1] ? r->compiled[1] : 1;
+    return rows % local[0] == 0 && cols % local[1] == 0 ? local : NULL;
+  }
+  size_t limit = r->workGroupSize < LOCAL_MAX ? r->workGroupSize : LOCAL_MAX;
+  local[0] = r->preferredMultiple > LOCAL_ROWS ? r->preferredMultiple
+                                                : LOCAL_ROWS;
+  local[0] = local[0] < limit ? local[0] : limit;
+  while (local[0] > 1 && rows % local[0]) {
+    local[0] /= 2;
+  }
+  local[1] = 1;
+  while (local[0] * local[1] * 2 <= limit && cols % (local[1] * 2) == 0) {
+    local[1] *= 2;
+  }
+  return local[0] * local[1] > 1 ? local : NULL;
+}
+
+// one line per kernel of what it uses & how it is launched
+void printKernelInfo(const char *name, const kernelResources *r,
+                     const size_t *local) {
+  printf("kernel %s: work-group max %zu, multiple %zu, local %llu B, "
+         "private %llu B",
+         name, r->workGroupSize, r->preferredMultiple,
+         (unsigned long long)r->localMem, (unsigned long long)r->privateMem);
+  if (r->compiled[0]) {
+    printf(", compiled for %zux%zu", r->compiled[0], r->compiled[1]);
+  }
+  if (local) {
+    printf(", launched %zux%zu\n", local[0], local[1]);
+  } else {
+    printf(", driver's local size\n");
+  }
 }
 
 // read device vectors back to host
-void readBuffer(cl_mem source, double *dest, cl_command_queue *commandQueue) {
+cl_int readBuffer(cl_mem source, double *dest, size_t size,
+                  cl_command_queue *commandQueue) {
+  cl_event traced;
   cl_int err;
-  err = clEnqueueReadBuffer(*commandQueue, source, CL_TRUE, 0,
-                            N * N * sizeof(*dest), (void *)dest, 0, NULL, NULL);
-  checkErr(err, "read device to host");
+  err = clEnqueueReadBuffer(*commandQueue, source, CL_TRUE, 0, size,
+                            (void *)dest, 0, NULL, traceEvent(&traced));
+  traceTake(traced, "read");
+  return checkErr(err, "read device to host");
 }
 
 void timeProf(double *nanoseconds, cl_event done) {
@@ -335,81 +461,348 @@ void timeProf(double *nanoseconds, cl_event done) {
   *nanoseconds = timeEnd - timeStart;
 }
 
-void runKernel(double *hA, double *hB, double *hC, char *filename, char *func) {
-  size_t bytes = N * N * sizeof(double *);
+// queued->submit, submit->start & start->end of a profiled command, in ns
+static void commandLatency(cl_event event, double *toSubmit, double *toStart,
+                           double *run) {
+  cl_ulong queued, submit, start, end;
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(queued),
+                          &queued, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(submit),
+                          &submit, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start),
+                          &start, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end,
+                          NULL);
+  *toSubmit = submit - queued;
+  *toStart = start - submit;
+  *run = end - start;
+}
+
+// where the wall time of runKernel went: host phases from the monotonic
+// clock, then every command from its events. device busy time against the
+// time spent queueing & waiting shows the gaps between commands.
+static void phaseBreakdown(const double *phases, cl_event *events) {
+  const char *phaseNames[] = {"buffers & uploads", "program & kernel",
+                              "kernel & download", "wait", "release"};
+  const char *commandNames[] = {"upload A", "upload B", "clear C", "kernel",
+                                "download C"};
+  double total = 0.0, busy = 0.0;
+  for (int p = 0; p < RUN_PHASES; p++) {
+    total += phases[p];
+  }
+
+  printf("%-18s %10s %7s\n", "phase", "ms", "share");
+  for (int p = 0; p < RUN_PHASES; p++) {
+    printf("%-18s %10.3f %6.1f%%\n", phaseNames[p], phases[p] * 1e3,
+           100.0 * phases[p] / total);
+  }
+  printf("%-18s %10.3f\n", "total", total * 1e3);
+
+  printf("%-18s %16s %15s %10s\n", "command", "queued-submit ms",
+         "submit-start ms", "run ms");
+  for (int c = 0; c < RUN_COMMANDS && events[c]; c++) {
+    double toSubmit, toStart, run;
+    commandLatency(events[c], &toSubmit, &toStart, &run);
+    busy += run;
+    printf("%-18s %16.3f %15.3f %10.3f\n", commandNames[c], toSubmit / 1e6,
+           toStart / 1e6, run / 1e6);
+  }
+  // uploads run while the program builds, so this can be negative
+  double host = (phases[RUN_BUFFERS] + phases[RUN_BUILD] + phases[RUN_QUEUE] +
+                 phases[RUN_WAIT]) * 1e9;
+  printf("device busy %.3f ms of %.3f ms from the buffers to the end, "
+         "%.3f ms idle or overhead\n",
+         busy / 1e6, host / 1e6, (host - busy) / 1e6);
+}
+
+// run one kernel over the whole matrices on the runtime's first queue and
+// print where the time went. the first call for a file builds or loads its
+// program, later ones find it in the runtime's cache; the uploads are queued
+// without blocking, so they overlap the build. returns the first OpenCL
+// error, with everything taken so far handed back, so the caller can retry
+// or fall back.
+cl_int runKernel(runtime *rt, const double *hA, const double *hB, double *hC,
+                 int n, char *filename, char *func) {
+  size_t bytes = (size_t)n * n * sizeof(double);
+  const size_t global[2] = {n, n};
+  size_t local[2];
+  kernelResources resources;
+  double phases[RUN_PHASES] = {0.0};
   double nanoseconds = 0.0f;
   cl_int ret;
+  cl_command_queue commandQueue = rt->queues[0];
+  cl_mem dA = NULL, dB = NULL, dC = NULL;
+  cl_kernel kernel = NULL;
+  cl_event events[RUN_COMMANDS] = {NULL};
+
+  // take buffers & queue the copies; C is cleared of any previous results
+  double mark = wallTime();
+  if ((ret = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dA)) ||
+      (ret = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dB)) ||
+      (ret = runtimeBuffer(rt, bytes, CL_MEM_READ_WRITE, &dC)) ||
+      (ret = clEnqueueWriteBuffer(commandQueue, dA, CL_FALSE, 0, bytes, hA, 0,
+                                  NULL, &events[0])) ||
+      (ret = clEnqueueWriteBuffer(commandQueue, dB, CL_FALSE, 0, bytes, hB, 0,
+                                  NULL, &events[1])) ||
+      (ret = clEnqueueWriteBuffer(commandQueue, dC, CL_FALSE, 0, bytes, hA, 0,
+                                  NULL, &events[2]))) {
+    checkErr(ret, "queued uploads");
+    goto cleanup;
+  }
+  traceCommand(events[0], "upload A");
+  traceCommand(events[1], "upload B");
+  traceCommand(events[2], "clear C");
+  clFlush(commandQueue);
+  phases[RUN_BUFFERS] = wallTime() - mark;
+
+  // program from the runtime, built or loaded on first use
+  mark = wallTime();
+  if ((ret = runtimeKernel(rt, filename, func, &kernel)) ||
+      (ret = kernelInfo(kernel, rt->deviceID, &resources)) ||
+      (ret = setArgs(&kernel, n, dA, dB, dC))) {
+    goto cleanup;
+  }
+  phases[RUN_BUILD] = wallTime() - mark;
+
+  // run it & queue the download behind it
+  mark = wallTime();
+  ret = clEnqueueNDRangeKernel(commandQueue, kernel, 2, NULL, global,
+                               kernelLocal(&resources, n, n, local), 0, NULL,
+                               &events[3]);
+  if (checkErr(ret, "queued kernel")) {
+    goto cleanup;
+  }
+  traceLaunch(events[3], kernel);
+  ret = clEnqueueReadBuffer(commandQueue, dC, CL_FALSE, 0, bytes, hC, 0, NULL,
+                            &events[4]);
+  if (checkErr(ret, "queued download")) {
+    goto cleanup;
+  }
+  traceCommand(events[4], "download C");
+  clFlush(commandQueue);
+  phases[RUN_QUEUE] = wallTime() - mark;
 
-  // initialize values
-  initHost(hA, hB);
-
-  // load kernel file
-  size_t kernelSize;
-  char *kernelSource = kernelFromFile(&kernelSize, filename);
+  mark = wallTime();
+  ret = checkErr(clFinish(commandQueue), "finished queue");
+  phases[RUN_WAIT] = wallTime() - mark;
 
-  // get platform & device
-  cl_platform_id platformID = NULL;
-  cl_device_id deviceID = NULL;
-  getPlatformDevice(&platformID, &deviceID);
+  // profiling
+  timeProf(&nanoseconds, events[3]);
+  printf("kernel %s:%s run in %f milliseconds\n", filename, func,
+         nanoseconds / 1000000.0);
+  printf("program built or loaded in %.3f ms\n", rt->buildTime * 1e3);
+  printKernelInfo(func, &resources, kernelLocal(&resources, n, n, local));
 
-  // create context
-  cl_context context;
-  createContext(&context, &platformID, &deviceID);
+cleanup:
+  mark = wallTime();
+  if (ret != CL_SUCCESS) {
+    clFinish(commandQueue);
+  }
+  for (int c = 0; c < RUN_COMMANDS; c++) {
+    if (events[c] && ret != CL_SUCCESS) {
+      clReleaseEvent(events[c]);
+      events[c] = NULL;
+    }
+  }
+  if (kernel) {
+    clReleaseKernel(kernel);
+  }
+  // the queue is finished, so the buffers can go straight back to the pool
+  runtimeRecycle(rt, dC);
+  runtimeRecycle(rt, dB);
+  runtimeRecycle(rt, dA);
+  phases[RUN_RELEASE] = wallTime() - mark;
+
+  // events outlive their commands, so they can be read after the release
+  if (ret == CL_SUCCESS) {
+    phaseBreakdown(phases, events);
+    for (int c = 0; c < RUN_COMMANDS; c++) {
+      clReleaseEvent(events[c]);
+    }
+  }
+  return ret;
+}
 
-  // create command queue
-  cl_command_queue commandQueue;
-  createQueue(&commandQueue, &context, &deviceID, 0, 1);
+//-----------------panelled multiply-----------------
+// start & end of a profiled command in nanoseconds
+static void eventSpan(cl_event event, cl_ulong *start, cl_ulong *end) {
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(*start),
+                          start, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(*end), end,
+                          NULL);
+}
 
-  // create buffers
-  cl_mem dA, dB, dC;
-  createBuffer(&dA, bytes, CL_MEM_READ_ONLY, &context);
-  createBuffer(&dB, bytes, CL_MEM_READ_ONLY, &context);
-  createBuffer(&dC, bytes, CL_MEM_READ_WRITE, &context);
-  writeBuffer(dA, hA, &commandQueue);
-  writeBuffer(dB, hB, &commandQueue);
-  writeBuffer(dC, hA, &commandQueue); // clear any previous results in output
+// print when each panel's upload, compute & download ran and how much of the
+// transfer time was hidden behind compute. events holds 3 per panel.
+void panelTrace(cl_event *events, int numPanels, int numQueues) {
+  cl_ulong first = (cl_ulong)-1, last = 0;
+  cl_ulong start[3], end[3];
+  double transfer = 0.0, compute = 0.0;
+
+  for (int i = 0; i < 3 * numPanels; i++) {
+    eventSpan(events[i], &start[0], &end[0]);
+    if (start[0] < first) {
+      first = start[0];
+    }
+    if (end[0] > last) {
+      last = end[0];
+    }
+  }
 
-  // create program from kernel source
-  cl_program program;
-  createProgramFromSource(&program, &context, kernelSource, &kernelSize);
+  printf("\npanel queue     upload(ms)        compute(ms)       "
+         "download(ms)\n");
+  for (int p = 0; p < numPanels; p++) {
+    for (int c = 0; c < 3; c++) {
+      eventSpan(events[3 * p + c], &start[c], &end[c]);
+      if (c == 1) {
+        compute += end[c] - start[c];
+      } else {
+        transfer += end[c] - start[c];
+      }
+    }
+    printf("%5d %5d  %7.3f-%-7.3f  %7.3f-%-7.3f  %7.3f-%-7.3f\n", p,
+           p % numQueues, (start[0] - first) / 1e6, (end[0] - first) / 1e6,
+           (start[1] - first) / 1e6, (end[1] - first) / 1e6,
+           (start[2] - first) / 1e6, (end[2] - first) / 1e6);
+  }
 
-  // build program
-  buildProgram(&program, &deviceID);
+  // anything beyond the wall time was running concurrently with something
+  double wall = last - first;
+  double hidden = transfer + compute - wall;
+  if (hidden < 0.0) {
+    hidden = 0.0;
+  }
+  if (hidden > transfer) {
+    hidden = transfer;
+  }
+  printf("wall %.3f ms, compute %.3f ms, transfer %.3f ms, "
+         "%.1f%% of transfer hidden\n",
+         wall / 1e6, compute / 1e6, transfer / 1e6,
+         transfer > 0.0 ? 100.0 * hidden / transfer : 0.0);
+}
 
-  // create kernel
-  cl_kernel kernel;
-  createKernel(&kernel, &program, func);
+// multiply with C split into column panels spread round-robin over numQueues
+// of the runtime's in-order queues, so panel i+1 uploads while panel i
+// computes and panel i-1 downloads
+cl_int runKernelPanels(runtime *rt, const double *hA, const double *hB,
+                       double *hC, int n, char *filename, char *func,
+                       int panelCols, int numQueues) {
+  size_t bytes = (size_t)n * n * sizeof(double);
+  cl_int ret;
+  cl_command_queue *queues = rt->queues;
+  cl_mem dA = NULL, dB[RUNTIME_QUEUES] = {NULL}, dC[RUNTIME_QUEUES] = {NULL};
+  cl_kernel kernel = NULL;
+  kernelResources resources;
+  size_t local[2];
+  cl_event uploadA = NULL;
+
+  // panels hold whole 16x16 tiles so mult2 can run on them unchanged
+  panelCols -= panelCols % 16;
+  if (panelCols < 16) {
+    panelCols = 16;
+  }
+  if (panelCols > n) {
+    panelCols = n;
+  }
+  if (numQueues < 1) {
+    numQueues = 1;
+  }
+  if (numQueues > RUNTIME_QUEUES) {
+    numQueues = RUNTIME_QUEUES;
+  }
+  int numPanels = (n + panelCols - 1) / panelCols;
+  size_t panelBytes = (size_t)n * panelCols * sizeof(double);
+  cl_event *events = (cl_event *)calloc(3 * numPanels, sizeof(cl_event));
+  if (!events) {
+    return CL_OUT_OF_HOST_MEMORY;
+  }
 
-  // set arguments
-  setArgs(&kernel, dA, dB, dC);
+  // A, one set of panel buffers per queue & the kernel, from the runtime
+  if ((ret = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dA))) {
+    goto cleanup;
+  }
+  for (int q = 0; q < numQueues; q++) {
+    if ((ret = runtimeBuffer(rt, panelBytes, CL_MEM_READ_ONLY, &dB[q])) ||
+        (ret = runtimeBuffer(rt, panelBytes, CL_MEM_WRITE_ONLY, &dC[q]))) {
+      goto cleanup;
+    }
+  }
+  if ((ret = runtimeKernel(rt, filename, func, &kernel)) ||
+      (ret = kernelInfo(kernel, rt->deviceID, &resources))) {
+    goto cleanup;
+  }
 
-  // exec kernel
-  cl_event done = NULL;
-  execKernel(commandQueue, kernel, &done);
+  // every panel needs all of A, so it goes up once and the kernels wait on it
+  ret = clEnqueueWriteBuffer(queues[0], dA, CL_FALSE, 0, bytes, hA, 0, NULL,
+                             &uploadA);
+  if (checkErr(ret, "queued upload of A")) {
+    goto cleanup;
+  }
+  traceCommand(uploadA, "upload A");
+  clFlush(queues[0]);
+
+  // C and B are column-major, so a column panel of either is contiguous and
+  // panel p of C only needs panel p of B
+  for (int p = 0; p < numPanels; p++) {
+    int q = p % numQueues;
+    int cols = n - p * panelCols < panelCols ? n - p * panelCols : panelCols;
+    size_t offset = (size_t)p * panelCols * n;
+    size_t size = (size_t)cols * n * sizeof(double);
+    const size_t global[2] = {n, cols};
+
+    ret = clEnqueueWriteBuffer(queues[q], dB[q], CL_FALSE, 0, size,
+                               hB + offset, 0, NULL, &events[3 * p]);
+    if (checkErr(ret, "queued panel upload") ||
+        (ret = setArgs(&kernel, n, dA, dB[q], dC[q]))) {
+      goto cleanup;
+    }
+    traceCommand(events[3 * p], "upload B panel");
+    ret = clEnqueueNDRangeKernel(queues[q], kernel, 2, NULL, global,
+                                 kernelLocal(&resources, n, cols, local), 1,
+                                 &uploadA, &events[3 * p + 1]);
+    if (checkErr(ret, "queued panel kernel")) {
+      goto cleanup;
+    }
+    traceLaunch(events[3 * p + 1], kernel);
+    ret = clEnqueueReadBuffer(queues[q], dC[q], CL_FALSE, 0, size,
+                              hC + offset, 0, NULL, &events[3 * p + 2]);
+    if (checkErr(ret, "queued panel download")) {
+      goto cleanup;
+    }
+    traceCommand(events[3 * p + 2], "download C panel");
+    clFlush(queues[q]);
+  }
 
-  readBuffer(dC, hC, &commandQueue);
-  ret = clFinish(commandQueue);
-  checkErr(ret, "finished queue");
+cleanup:
+  // drain whatever was queued before handing back anything it uses
+  for (int q = 0; q < numQueues; q++) {
+    cl_int finished = checkErr(clFinish(queues[q]), "finished queue");
+    ret = ret ? ret : finished;
+  }
+  if (ret == CL_SUCCESS) {
+    printf("kernel %s:%s in %d panels of %d columns over %d queues\n",
+           filename, func, numPanels, panelCols, numQueues);
+    printKernelInfo(func, &resources,
+                    kernelLocal(&resources, n, panelCols, local));
+    panelTrace(events, numPanels, numQueues);
+  }
 
-  // profiling
-  timeProf(&nanoseconds, done);
-
-  ret = clReleaseEvent(done);
-  checkErr(ret, "released event");
-  ret = clReleaseKernel(kernel);
-  checkErr(ret, "released kernel");
-  ret = clReleaseProgram(program);
-  checkErr(ret, "released program");
-  ret = clReleaseMemObject(dC);
-  ret |= clReleaseMemObject(dB);
-  ret |= clReleaseMemObject(dA);
-  checkErr(ret, "released mem buffers");
-  ret = clReleaseCommandQueue(commandQueue);
-  checkErr(ret, "released command queue");
-  ret = clReleaseContext(context);
-  checkErr(ret, "released context");
-  free(kernelSource);
-  checkErr(ret, "freed kernel source");
-  printf("!\nkernel %s:%s run in %f milliseconds\n", filename, func,
-         nanoseconds / 1000000.0);
-}
\ No newline at end of file
+  for (int i = 0; i < 3 * numPanels; i++) {
+    if (events[i]) {
+      clReleaseEvent(events[i]);
+    }
+  }
+  if (uploadA) {
+    clReleaseEvent(uploadA);
+  }
+  if (kernel) {
+    clReleaseKernel(kernel);
+  }
+  for (int q = 0; q < numQueues; q++) {
+    runtimeRecycle(rt, dB[q]);
+    runtimeRecycle(rt, dC[q]);
+  }
+  runtimeRecycle(rt, dA);
+  free(events);
+  return ret;
+}
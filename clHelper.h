@@ -7,50 +7,103 @@
 #include <stdio.h>
 #include <time.h>
 
-#define N 2048
-#define VERBOSE 0
+#define N 2048 // default matrix size
+#ifndef VERBOSE
+#define VERBOSE 0 // 1 reports every successful call
+#endif
+#define RUN_COMMANDS 5 // commands runKernel queues: 3 uploads, kernel, download
+#define LOCAL_MAX 256  // work-items per group the launches aim for
+#define LOCAL_ROWS 16  // fewest rows of C per group, for whole cache lines
+
+// host phases of runKernel, timed separately
+enum {
+  RUN_BUFFERS,
+  RUN_BUILD,
+  RUN_QUEUE,
+  RUN_WAIT,
+  RUN_RELEASE,
+  RUN_PHASES
+};
+
+// what the compiler made of a kernel for one device
+typedef struct {
+  size_t workGroupSize;     // largest work-group it can be launched with
+  size_t preferredMultiple; // work-group sizes should be multiples of this
+  cl_ulong localMem;        // bytes of local memory per work-group
+  cl_ulong privateMem;      // bytes of private memory per work-item
+  size_t compiled[3];       // reqd_work_group_size, 0s when it has none
+} kernelResources;
 
 const char *getErrorString(cl_int error);
 
-void checkErr(cl_int error, char *success);
+cl_int reportErr(cl_int error, const char *what);
 
-double randdouble(double min, double max);
+// report a failed call & hand its code back so callers can propagate it. the
+// success path is a single compare unless VERBOSE is set.
+static inline cl_int checkErr(cl_int error, const char *what) {
+  if (error != CL_SUCCESS || VERBOSE) {
+    return reportErr(error, what);
+  }
+  return error;
+}
 
-void initHost(double *hA, double *hB);
+int isResourceError(cl_int error);
+
+void initHost(double *hA, double *hB, int n);
 
 char *kernelFromFile(size_t *kernelSize, char *filename);
 
-void getPlatformDevice(cl_platform_id *platformID, cl_device_id *deviceID);
+cl_int getPlatformDevice(cl_platform_id *platformID, cl_device_id *deviceID);
+
+cl_uint getAllDevices(cl_platform_id **platforms, cl_device_id **devices);
+
+cl_int createContext(cl_context *context, cl_platform_id *platformID,
+                     cl_device_id *deviceID);
+
+cl_int createQueue(cl_command_queue *commandQueue, cl_context *context,
+                   cl_device_id *deviceID, int outOfOrder, int profiling);
 
-void createContext(cl_context *context, cl_platform_id *platformID,
-                   cl_device_id *deviceID);
+cl_int createBuffer(cl_mem *deviceBuffer, size_t size, int direction,
+                    cl_context *context);
 
-void createQueue(cl_command_queue *commandQueue, cl_context *context,
-                 cl_device_id *deviceID, int outOfOrder, int profiling);
+cl_int writeBuffer(cl_mem dest, const double *source, size_t size,
+                   cl_command_queue *commandQueue);
 
-void createBuffer(cl_mem *deviceBuffer, size_t size, int direction,
-                  cl_context *context);
+cl_int createProgramFromSource(cl_program *program, cl_context *context,
+                               const char *kernelSource, size_t *kernelSize);
 
-void writeBuffer(cl_mem dest, double *source, cl_command_queue *commandQueue);
+cl_int buildProgram(cl_program *program, cl_device_id *deviceID);
 
-void createProgramFromSource(cl_program *program, cl_context *context,
-                             const char *kernelSource, size_t *kernelSize);
+double lastBuildTime(void);
 
-void buildProgram(cl_program *program, cl_device_id *deviceID);
+cl_int createKernel(cl_kernel *kernel, cl_program *program, char *funcName);
 
-void createKernel(cl_kernel *kernel, cl_program *program, char *funcName);
+cl_int setArgs(cl_kernel *kernel, int n, cl_mem dA, cl_mem dB, cl_mem dC);
 
-void setArgs(cl_kernel *kernel, cl_mem dA, cl_mem dB, cl_mem dC);
+cl_int kernelInfo(cl_kernel kernel, cl_device_id device, kernelResources *r);
 
-void execKernel(cl_command_queue commandQueue, cl_kernel kernel,
-                cl_event *event);
+const size_t *kernelLocal(const kernelResources *r, size_t rows, size_t cols,
+                          size_t local[2]);
 
-void readBuffer(cl_mem source, double *dest, cl_command_queue *commandQueue);
+void printKernelInfo(const char *name, const kernelResources *r,
+                     const size_t *local);
+
+cl_int readBuffer(cl_mem source, double *dest, size_t size,
+                  cl_command_queue *commandQueue);
 
 void gpuBench(double *A, double *B, double *C, double nanoseconds);
 
 void timeProf(double *nanoseconds, cl_event done);
 
-void runKernel(double *hA, double *hB, double *hC, char *filename, char *func);
+struct runtime; // runtime.h, which builds on this file
+
+cl_int runKernel(struct runtime *rt, const double *hA, const double *hB,
+                 double *hC, int n, char *filename, char *func);
+
+void panelTrace(cl_event *events, int numPanels, int numQueues);
+
+cl_int runKernelPanels(struct runtime *rt, const double *hA, const double *hB,
+                       double *hC, int n, char *filename, char *func,
+                       int panelCols, int numQueues);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+// clbench <suite> [options]: microbenchmarks of the OpenCL plumbing under
+// matrixOp & libclmatmul, on the device --device or CLMM_DEVICE picks
+//
+//   transfer  host <-> device bandwidth & latency over buffer sizes
+//   launch    kernel launch rate & enqueue to start latency
+
+#include "deviceSelect.h"
+#include "launch.h"
+#include "runtime.h"
+#include "transfer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// bytes, with an optional k, m or g suffix
+static size_t parseBytes(const char *text) {
+  char *end;
+  size_t bytes = strtoull(text, &end, 10);
+  switch (*end) {
+  case 'g':
+  case 'G':
+    return bytes << 30;
+  case 'm':
+  case 'M':
+    return bytes << 20;
+  case 'k':
+  case 'K':
+    return bytes << 10;
+  default:
+    return bytes;
+  }
+}
+
+static int usage(void) {
+  fprintf(stderr,
+          "usage: clbench transfer [--min <bytes>] [--max <bytes>] "
+          "[--reps <k>] [--out <file.csv>] [--device <spec>]\n"
+          "       clbench launch [--count <launches>] [--threads <k>] "
+          "[--device <spec>]\n");
+  return 2;
+}
+
+int main(int argc, char *argv[]) {
+  int transfer = argc > 1 && !strcmp(argv[1], "transfer");
+  int launch = argc > 1 && !strcmp(argv[1], "launch");
+  if (!transfer && !launch) {
+    return usage();
+  }
+  size_t minBytes = TRANSFER_MIN, maxBytes = TRANSFER_MAX;
+  int reps = 0, count = LAUNCH_COUNT, threads = LAUNCH_THREADS;
+  const char *outPath = NULL;
+  for (int i = 2; i < argc; i++) {
+    if (transfer && !strcmp(argv[i], "--min") && i + 1 < argc) {
+      minBytes = parseBytes(argv[++i]);
+    } else if (transfer && !strcmp(argv[i], "--max") && i + 1 < argc) {
+      maxBytes = parseBytes(argv[++i]);
+    } else if (transfer && !strcmp(argv[i], "--reps") && i + 1 < argc) {
+      reps = atoi(argv[++i]);
+    } else if (transfer && !strcmp(argv[i], "--out") && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (launch && !strcmp(argv[i], "--count") && i + 1 < argc) {
+      count = atoi(argv[++i]);
+    } else if (launch && !strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+      setDeviceSpec(argv[++i]);
+    } else {
+      return usage();
+    }
+  }
+  if (count < 1 || threads < 1) {
+    return usage();
+  }
+
+  runtime rt;
+  if (runtimeInit(&rt, NULL)) {
+    return 1;
+  }
+  int failed = transfer
+                   ? runTransfer(&rt, minBytes, maxBytes, reps, outPath) != 0
+                   : runLaunch(&rt, count, threads) != 0;
+  runtimeShutdown(&rt);
+  return failed;
+}
@@ -0,0 +1,302 @@
+#include "clmatmul.h"
+#include "deviceSelect.h"
+#include "multiDevice.h"
+#include "runtime.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLMM_SLOTS 2 // queue & buffer sets batched calls rotate through
+
+#if CLMM_MAX_QUEUES != RUNTIME_QUEUES
+#error "clmmGemmPanels spreads over the runtime's queues"
+#endif
+
+// the device, queues, program & buffer pool come from the shared runtime
+struct clmmContext {
+  runtime rt;
+  char path[512]; // of matrix.cl
+  cl_program program;
+  cl_kernel mult, mult2;
+  cl_kernel fixed; // set by clmmSetKernel, NULL to choose by size
+  char fixedName[64];
+  kernelResources multInfo, mult2Info, fixedInfo; // size the work-groups
+  double buildTime; // seconds matrix.cl took to build or load
+  cl_mem dA[CLMM_SLOTS], dB[CLMM_SLOTS], dC[CLMM_SLOTS];
+  double lastKernelTime;
+};
+
+int clmmVersion(void) { return CLMM_VERSION; }
+
+const char *clmmErrorString(int error) { return getErrorString(error); }
+
+// matrix.cl from CLMM_KERNELS, else the working directory
+static void kernelPath(char *path, size_t size) {
+  const char *env = getenv(CLMM_KERNEL_ENV);
+  snprintf(path, size, "%s", env && *env ? env : "matrix.cl");
+}
+
+int clmmInit(clmmContext **ctx, const char *deviceSpec) {
+  cl_int err;
+
+  *ctx = NULL;
+  clmmContext *c = (clmmContext *)calloc(1, sizeof(clmmContext));
+  if (!c) {
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+  if ((err = runtimeInit(&c->rt, deviceSpec))) {
+    free(c);
+    return err;
+  }
+  kernelPath(c->path, sizeof(c->path));
+  if ((err = runtimeProgram(&c->rt, c->path, &c->program)) ||
+      (err = createKernel(&c->mult, &c->program, "mult")) ||
+      (err = createKernel(&c->mult2, &c->program, "mult2")) ||
+      (err = kernelInfo(c->mult, c->rt.deviceID, &c->multInfo)) ||
+      (err = kernelInfo(c->mult2, c->rt.deviceID, &c->mult2Info))) {
+    clmmShutdown(c);
+    return err;
+  }
+  c->buildTime = c->rt.buildTime;
+  *ctx = c;
+  return CL_SUCCESS;
+}
+
+int clmmSetKernel(clmmContext *ctx, const char *name) {
+  if (ctx->fixed) {
+    clReleaseKernel(ctx->fixed);
+    ctx->fixed = NULL;
+  }
+  if (!name) {
+    return CL_SUCCESS;
+  }
+  cl_int err;
+  if ((err = createKernel(&ctx->fixed, &ctx->program, (char *)name)) ||
+      (err = kernelInfo(ctx->fixed, ctx->rt.deviceID, &ctx->fixedInfo))) {
+    if (ctx->fixed) {
+      clReleaseKernel(ctx->fixed);
+      ctx->fixed = NULL;
+    }
+    return err;
+  }
+  snprintf(ctx->fixedName, sizeof(ctx->fixedName), "%s", name);
+  return CL_SUCCESS;
+}
+
+int clmmKernelInfo(const clmmContext *ctx, const char *name, int n,
+                   clmmKernelResources *info) {
+  cl_kernel kernel;
+  kernelResources r;
+  size_t local[2];
+  cl_int err;
+  if ((err = createKernel(&kernel, (cl_program *)&ctx->program,
+                          (char *)name))) {
+    return err;
+  }
+  err = kernelInfo(kernel, ctx->rt.deviceID, &r);
+  clReleaseKernel(kernel);
+  if (err) {
+    return err;
+  }
+  memset(info, 0, sizeof(*info));
+  info->workGroupSize = r.workGroupSize;
+  info->preferredMultiple = r.preferredMultiple;
+  info->localMem = r.localMem;
+  info->privateMem = r.privateMem;
+  info->compiled[0] = r.compiled[0];
+  info->compiled[1] = r.compiled[1];
+  if (kernelLocal(&r, n, n, local)) {
+    info->local[0] = local[0];
+    info->local[1] = local[1];
+  }
+  info->buildTime = ctx->buildTime * 1e3;
+  return CL_SUCCESS;
+}
+
+// buffers of a slot for one call, from the runtime pool
+static cl_int takeBuffers(clmmContext *ctx, int slot, size_t bytes) {
+  cl_int err;
+  if ((err = runtimeBuffer(&ctx->rt, bytes, CL_MEM_READ_ONLY,
+                           &ctx->dA[slot])) ||
+      (err = runtimeBuffer(&ctx->rt, bytes, CL_MEM_READ_ONLY,
+                           &ctx->dB[slot])) ||
+      (err = runtimeBuffer(&ctx->rt, bytes, CL_MEM_WRITE_ONLY,
+                           &ctx->dC[slot]))) {
+    return err;
+  }
+  return CL_SUCCESS;
+}
+
+// back to the pool once the slot's queue is finished
+static void returnBuffers(clmmContext *ctx, int slot) {
+  runtimeRecycle(&ctx->rt, ctx->dA[slot]);
+  runtimeRecycle(&ctx->rt, ctx->dB[slot]);
+  runtimeRecycle(&ctx->rt, ctx->dC[slot]);
+  ctx->dA[slot] = ctx->dB[slot] = ctx->dC[slot] = NULL;
+}
+
+// queue one product on a slot without waiting for it
+static cl_int enqueueGemm(clmmContext *ctx, int slot, int n, const double *A,
+                          const double *B, double *C, cl_event *done) {
+  size_t bytes = (size_t)n * n * sizeof(double);
+  const size_t global[2] = {n, n};
+  size_t local[2];
+  cl_command_queue queue = ctx->rt.queues[slot];
+  cl_kernel kernel = ctx->fixed;
+  const kernelResources *resources = &ctx->fixedInfo;
+  cl_event traced;
+  cl_int err;
+
+  // unforced, mult2 wherever the grid is whole tiles of it
+  if (!kernel) {
+    int tiled = kernelLocal(&ctx->mult2Info, n, n, local) != NULL;
+    kernel = tiled ? ctx->mult2 : ctx->mult;
+    resources = tiled ? &ctx->mult2Info : &ctx->multInfo;
+  }
+  const size_t *groups = kernelLocal(resources, n, n, local);
+  if (!groups && resources->compiled[0]) {
+    return checkErr(CL_INVALID_WORK_GROUP_SIZE,
+                    "n is not a multiple of the kernel's work-group");
+  }
+  err = clEnqueueWriteBuffer(queue, ctx->dA[slot], CL_FALSE, 0, bytes, A, 0,
+                             NULL, traceEvent(&traced));
+  traceTake(traced, "upload A");
+  if (checkErr(err, "queued upload of A")) {
+    return err;
+  }
+  err = clEnqueueWriteBuffer(queue, ctx->dB[slot], CL_FALSE, 0, bytes, B, 0,
+                             NULL, traceEvent(&traced));
+  traceTake(traced, "upload B");
+  if (checkErr(err, "queued upload of B") ||
+      (err = setArgs(&kernel, n, ctx->dA[slot], ctx->dB[slot],
+                     ctx->dC[slot]))) {
+    return err;
+  }
+  err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, groups, 0,
+                               NULL, done);
+  if (checkErr(err, "queued kernel")) {
+    return err;
+  }
+  traceLaunch(*done, kernel);
+  err = clEnqueueReadBuffer(queue, ctx->dC[slot], CL_FALSE, 0, bytes, C, 0,
+                            NULL, traceEvent(&traced));
+  traceTake(traced, "download C");
+  checkErr(err, "queued download of C");
+  clFlush(queue);
+  return err;
+}
+
+int clmmGemm(clmmContext *ctx, int n, const double *A, const double *B,
+             double *C) {
+  return clmmGemmBatched(ctx, n, 1, &A, &B, &C);
+}
+
+int clmmGemmBatched(clmmContext *ctx, int n, int count,
+                    const double *const *A, const double *const *B,
+                    double *const *C) {
+  if (n < 1 || count < 1) {
+    return CL_INVALID_VALUE;
+  }
+  cl_event *done = (cl_event *)calloc(count, sizeof(cl_event));
+  size_t bytes = (size_t)n * n * sizeof(double);
+  cl_int err = CL_SUCCESS;
+  double nanoseconds;
+  if (!done) {
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+
+  // in-order queues make a slot's buffers safe to reuse two products later
+  for (int s = 0; s < CLMM_SLOTS && s < count && err == CL_SUCCESS; s++) {
+    err = takeBuffers(ctx, s, bytes);
+  }
+  for (int i = 0; i < count && err == CL_SUCCESS; i++) {
+    err = enqueueGemm(ctx, i % CLMM_SLOTS, n, A[i], B[i], C[i], &done[i]);
+  }
+  for (int s = 0; s < CLMM_SLOTS; s++) {
+    cl_int finished =
+        checkErr(clFinish(ctx->rt.queues[s]), "finished queue");
+    err = err ? err : finished;
+    returnBuffers(ctx, s);
+  }
+
+  ctx->lastKernelTime = 0.0;
+  for (int i = 0; i < count; i++) {
+    if (done[i]) {
+      timeProf(&nanoseconds, done[i]);
+      ctx->lastKernelTime += nanoseconds / 1000000.0;
+      clReleaseEvent(done[i]);
+    }
+  }
+  free(done);
+  return err;
+}
+
+// kernel the diagnostic paths run: the forced one, else as enqueueGemm picks
+static char *kernelName(clmmContext *ctx, int n) {
+  size_t local[2];
+  if (ctx->fixed) {
+    return ctx->fixedName;
+  }
+  return kernelLocal(&ctx->mult2Info, n, n, local) ? "mult2" : "mult";
+}
+
+int clmmGemmPanels(clmmContext *ctx, int n, const double *A, const double *B,
+                   double *C, int panelCols, int queues) {
+  return runKernelPanels(&ctx->rt, A, B, C, n, ctx->path,
+                         kernelName(ctx, n), panelCols, queues);
+}
+
+int clmmGemmBreakdown(clmmContext *ctx, int n, const double *A,
+                      const double *B, double *C) {
+  return runKernel(&ctx->rt, A, B, C, n, ctx->path, kernelName(ctx, n));
+}
+
+int clmmGemmAllDevices(const char *name, int n, const double *A,
+                       const double *B, double *C, int panelCols) {
+  char path[512];
+  kernelPath(path, sizeof(path));
+  if (!name) {
+    name = n % 16 == 0 ? "mult2" : "mult";
+  }
+  return runKernelMultiDevice(A, B, C, n, path, (char *)name, panelCols);
+}
+
+void clmmTrim(clmmContext *ctx) { runtimeTrim(&ctx->rt); }
+
+double clmmLastKernelTime(const clmmContext *ctx) {
+  return ctx->lastKernelTime;
+}
+
+int clmmDeviceInfo(const clmmContext *ctx, char *name, size_t nameSize,
+                   char *driver, size_t driverSize) {
+  char text[2][1024];
+  cl_int err;
+  if ((err = clGetDeviceInfo(ctx->rt.deviceID, CL_DEVICE_NAME,
+                             sizeof(text[0]), text[0], NULL)) ||
+      (err = clGetDeviceInfo(ctx->rt.deviceID, CL_DRIVER_VERSION,
+                             sizeof(text[1]), text[1], NULL))) {
+    return checkErr(err, "got device info");
+  }
+  snprintf(name, nameSize, "%s", text[0]);
+  snprintf(driver, driverSize, "%s", text[1]);
+  return CL_SUCCESS;
+}
+
+void clmmShutdown(clmmContext *ctx) {
+  if (!ctx) {
+    return;
+  }
+  if (ctx->fixed) {
+    clReleaseKernel(ctx->fixed);
+  }
+  if (ctx->mult) {
+    clReleaseKernel(ctx->mult);
+  }
+  if (ctx->mult2) {
+    clReleaseKernel(ctx->mult2);
+  }
+  // the program, queues & pooled buffers belong to the runtime
+  runtimeShutdown(&ctx->rt);
+  free(ctx);
+}
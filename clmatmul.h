@@ -0,0 +1,102 @@
+// libclmatmul: OpenCL matrix multiplication behind a stable C API.
+// matrices are square, column-major doubles. a context is not thread safe;
+// use one per thread.
+
+#ifndef CLMATMUL_H_
+#define CLMATMUL_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define CLMM_API __attribute__((visibility("default")))
+#else
+#define CLMM_API
+#endif
+
+#define CLMM_VERSION 1
+#define CLMM_KERNEL_ENV "CLMM_KERNELS" // path of matrix.cl, default ./
+#define CLMM_MAX_QUEUES 3 // most queues clmmGemmPanels spreads panels over
+
+typedef struct clmmContext clmmContext;
+
+// what the device compiler made of a kernel, and how an n x n multiply
+// launches it
+typedef struct {
+  size_t workGroupSize;           // largest work-group it can run
+  size_t preferredMultiple;       // work-groups should be multiples of this
+  unsigned long long localMem;    // bytes of local memory per work-group
+  unsigned long long privateMem;  // bytes of private memory per work-item
+  size_t compiled[2];             // required work-group, 0s when free
+  size_t local[2];                // work-group used at n, 0s for the driver's
+  double buildTime;               // ms matrix.cl took to build or load
+} clmmKernelResources;
+
+// every call returning int gives 0 on success or a negative OpenCL error code
+
+// pick a device (a spec as for --device, NULL for CLMM_DEVICE or the
+// default), build the kernels and keep them ready for any number of calls
+CLMM_API int clmmInit(clmmContext **ctx, const char *deviceSpec);
+
+// force a kernel from matrix.cl; NULL picks mult2 when n is a multiple of its
+// 16x16 work-group and mult otherwise
+CLMM_API int clmmSetKernel(clmmContext *ctx, const char *name);
+
+// C = A * B
+CLMM_API int clmmGemm(clmmContext *ctx, int n, const double *A,
+                      const double *B, double *C);
+
+// C[i] = A[i] * B[i] for count products of the same size, with the copies of
+// one product overlapping the compute of the next. n & count must be >= 1.
+CLMM_API int clmmGemmBatched(clmmContext *ctx, int n, int count,
+                             const double *const *A, const double *const *B,
+                             double *const *C);
+
+// C = A * B with C in column panels of panelCols (whole 16x16 tiles) spread
+// over 1 to CLMM_MAX_QUEUES in-order queues, so copies overlap compute;
+// prints when each panel's copies & kernel ran
+CLMM_API int clmmGemmPanels(clmmContext *ctx, int n, const double *A,
+                            const double *B, double *C, int panelCols,
+                            int queues);
+
+// C = A * B in one pass, printing the wall time of each host phase and the
+// latency of each command
+CLMM_API int clmmGemmBreakdown(clmmContext *ctx, int n, const double *A,
+                               const double *B, double *C);
+
+// C = A * B with the columns of C shared by every double precision device on
+// the host, in chunks of at least panelCols; prints each device's share.
+// name is a kernel of matrix.cl, NULL for mult2 or mult as n allows.
+CLMM_API int clmmGemmAllDevices(const char *name, int n, const double *A,
+                                const double *B, double *C, int panelCols);
+
+// release the device buffers kept for reuse, as before retrying a call that
+// ran out of device memory in smaller panels
+CLMM_API void clmmTrim(clmmContext *ctx);
+
+// device milliseconds the kernels of the last clmmGemm or clmmGemmBatched
+// call took
+CLMM_API double clmmLastKernelTime(const clmmContext *ctx);
+
+// resources of a kernel of matrix.cl on the context's device
+CLMM_API int clmmKernelInfo(const clmmContext *ctx, const char *name, int n,
+                            clmmKernelResources *info);
+
+// name & driver version of the context's device, each cut to its size
+CLMM_API int clmmDeviceInfo(const clmmContext *ctx, char *name,
+                            size_t nameSize, char *driver, size_t driverSize);
+
+CLMM_API void clmmShutdown(clmmContext *ctx);
+
+CLMM_API const char *clmmErrorString(int error);
+
+CLMM_API int clmmVersion(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
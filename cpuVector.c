@@ -0,0 +1,268 @@
+#include "cpuVector.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct {
+  reduceOp op;
+  int isFloat;
+  const void *x, *y;
+  double *partial; // one per thread
+} reduceJob;
+
+#define REDUCE_RANGE(T)                                                        \
+  {                                                                            \
+    const T *x = (const T *)job->x, *y = (const T *)job->y;                    \
+    switch (job->op) {                                                         \
+    case REDUCE_SUM:                                                           \
+      for (size_t i = begin; i < end; i++) {                                   \
+        acc += x[i];                                                           \
+      }                                                                        \
+      break;                                                                   \
+    case REDUCE_DOT:                                                           \
+      for (size_t i = begin; i < end; i++) {                                   \
+        acc += (double)x[i] * y[i];                                            \
+      }                                                                        \
+      break;                                                                   \
+    case REDUCE_NRM2:                                                          \
+      for (size_t i = begin; i < end; i++) {                                   \
+        acc += (double)x[i] * x[i];                                            \
+      }                                                                        \
+      break;                                                                   \
+    case REDUCE_AMAX:                                                          \
+      for (size_t i = begin; i < end; i++) {                                   \
+        acc = fmax(acc, fabs(x[i]));                                           \
+      }                                                                        \
+      break;                                                                   \
+    }                                                                          \
+  }
+
+static void reduceRange(size_t begin, size_t end, int thread, void *arg) {
+  reduceJob *job = (reduceJob *)arg;
+  double acc = 0.0;
+  if (job->isFloat) {
+    REDUCE_RANGE(float)
+  } else {
+    REDUCE_RANGE(double)
+  }
+  job->partial[thread] = acc;
+}
+
+double cpuReduce(reduceOp op, int isFloat, const void *x, const void *y,
+                 size_t n, int threads) {
+  if (threads < 1) {
+    threads = 1;
+  }
+  reduceJob job = {op, isFloat, x, y ? y : x, NULL};
+  job.partial = (double *)calloc(threads, sizeof(double));
+  if (!job.partial) {
+    return NAN;
+  }
+  parallelFor(n, threads, reduceRange, &job);
+
+  // threads beyond n never ran and left their partial at zero
+  double result = 0.0;
+  for (int t = 0; t < threads; t++) {
+    result = op == REDUCE_AMAX ? fmax(result, job.partial[t])
+                               : result + job.partial[t];
+  }
+  free(job.partial);
+  return op == REDUCE_NRM2 ? sqrt(result) : result;
+}
+
+//-----------------elementwise-----------------
+typedef struct {
+  vectorOp op;
+  double *C;
+  const double *A, *B;
+  double s;
+  int stream; // bypass the cache on stores
+} vectorJob;
+
+size_t llcBytes(void) {
+#ifdef _SC_LEVEL3_CACHE_SIZE
+  long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (size > 0) {
+    return size;
+  }
+#endif
+  return LLC_FALLBACK;
+}
+
+static inline double scalarOp(vectorOp op, double a, double b, double s) {
+  switch (op) {
+  case VECTOR_COPY:
+    return a;
+  case VECTOR_SCALE:
+    return s * a;
+  case VECTOR_ADD:
+    return a + b;
+  case VECTOR_MULT:
+    return a * b;
+  default:
+    return a + s * b;
+  }
+}
+
+#ifdef __SSE2__
+static inline __m128d pairOp(vectorOp op, __m128d a, __m128d b, __m128d s) {
+  switch (op) {
+  case VECTOR_COPY:
+    return a;
+  case VECTOR_SCALE:
+    return _mm_mul_pd(s, a);
+  case VECTOR_ADD:
+    return _mm_add_pd(a, b);
+  case VECTOR_MULT:
+    return _mm_mul_pd(a, b);
+  default:
+    return _mm_add_pd(a, _mm_mul_pd(s, b));
+  }
+}
+#endif
+
+// op over C[i, end). each caller passes op as a constant, so once this is
+// inlined every switch in the loops below folds to the one operation
+static inline __attribute__((always_inline)) void
+vectorLoop(vectorOp op, double *C, const double *A, const double *B, double s,
+           size_t i, size_t end, int stream) {
+#ifdef __SSE2__
+  // peel to a 16-byte aligned C, then two doubles at a time. streaming
+  // stores write whole lines around the cache instead of reading them first
+  if (!((uintptr_t)C & 7)) {
+    for (; i < end && ((uintptr_t)(C + i) & 15); i++) {
+      C[i] = scalarOp(op, A[i], B[i], s);
+    }
+    __m128d vs = _mm_set1_pd(s);
+    if (stream) {
+      for (; i + 4 <= end; i += 4) {
+        _mm_stream_pd(C + i, pairOp(op, _mm_loadu_pd(A + i),
+                                    _mm_loadu_pd(B + i), vs));
+        _mm_stream_pd(C + i + 2, pairOp(op, _mm_loadu_pd(A + i + 2),
+                                        _mm_loadu_pd(B + i + 2), vs));
+      }
+      _mm_sfence();
+    } else {
+      for (; i + 4 <= end; i += 4) {
+        _mm_store_pd(C + i, pairOp(op, _mm_loadu_pd(A + i),
+                                   _mm_loadu_pd(B + i), vs));
+        _mm_store_pd(C + i + 2, pairOp(op, _mm_loadu_pd(A + i + 2),
+                                       _mm_loadu_pd(B + i + 2), vs));
+      }
+    }
+  }
+#else
+  (void)stream;
+#endif
+  for (; i < end; i++) {
+    C[i] = scalarOp(op, A[i], B[i], s);
+  }
+}
+
+// the switch on op is taken once per range, not once per element
+static void vectorRange(size_t begin, size_t end, int thread, void *arg) {
+  vectorJob *job = (vectorJob *)arg;
+  double *C = job->C;
+  const double *A = job->A, *B = job->B ? job->B : job->A;
+  double s = job->s;
+  int stream = job->stream;
+  (void)thread;
+  switch (job->op) {
+  case VECTOR_COPY:
+    vectorLoop(VECTOR_COPY, C, A, B, s, begin, end, stream);
+    break;
+  case VECTOR_SCALE:
+    vectorLoop(VECTOR_SCALE, C, A, B, s, begin, end, stream);
+    break;
+  case VECTOR_ADD:
+    vectorLoop(VECTOR_ADD, C, A, B, s, begin, end, stream);
+    break;
+  case VECTOR_MULT:
+    vectorLoop(VECTOR_MULT, C, A, B, s, begin, end, stream);
+    break;
+  default:
+    vectorLoop(VECTOR_TRIAD, C, A, B, s, begin, end, stream);
+    break;
+  }
+}
+
+// C = op(A, B) across the host threads. outputs bigger than the last level
+// cache would only evict the inputs, so they are written with streaming
+// stores; smaller ones stay cached for whoever reads them next.
+void cpuVectorOp(vectorOp op, double *C, const double *A, const double *B,
+                 double s, size_t n, int threads) {
+  vectorJob job = {op, C, A, B, s, n * sizeof(double) > llcBytes()};
+  parallelFor(n, threads, vectorRange, &job);
+}
+
+//-----------------scan-----------------
+typedef struct {
+  int isInt, inclusive;
+  const void *in;
+  void *out;
+  double *totals; // per thread: its slice's sum, then the sum before it
+  int pass;
+} scanJob;
+
+#define SCAN_RANGE(T)                                                          \
+  {                                                                            \
+    const T *in = (const T *)job->in;                                          \
+    T *out = (T *)job->out;                                                    \
+    if (job->pass == 0) {                                                      \
+      T sum = 0;                                                               \
+      for (size_t i = begin; i < end; i++) {                                   \
+        sum += in[i];                                                          \
+      }                                                                        \
+      job->totals[thread] = sum;                                               \
+    } else {                                                                   \
+      T sum = (T)job->totals[thread];                                          \
+      for (size_t i = begin; i < end; i++) {                                   \
+        T x = in[i];                                                           \
+        out[i] = job->inclusive ? sum + x : sum;                               \
+        sum += x;                                                              \
+      }                                                                        \
+    }                                                                          \
+  }
+
+static void scanRange(size_t begin, size_t end, int thread, void *arg) {
+  scanJob *job = (scanJob *)arg;
+  if (job->isInt) {
+    SCAN_RANGE(int)
+  } else {
+    SCAN_RANGE(double)
+  }
+}
+
+// two passes over equal slices: each thread sums its slice, the slice totals
+// are scanned serially, then each thread scans its slice from its offset.
+// int totals stay exact in double up to 2^53. in & out may be the same.
+void cpuScan(int isInt, int inclusive, const void *in, void *out, size_t n,
+             int threads) {
+  if (threads < 1) {
+    threads = 1;
+  }
+  double single = 0.0;
+  scanJob job = {isInt, inclusive, in, out, NULL, 0};
+  job.totals = (double *)calloc(threads, sizeof(double));
+  if (!job.totals) {
+    threads = 1;
+    job.totals = &single;
+  }
+  parallelFor(n, threads, scanRange, &job);
+  double offset = 0.0;
+  for (int t = 0; t < threads; t++) {
+    double total = job.totals[t];
+    job.totals[t] = offset;
+    offset += total;
+  }
+  job.pass = 1;
+  parallelFor(n, threads, scanRange, &job);
+  if (job.totals != &single) {
+    free(job.totals);
+  }
+}
@@ -0,0 +1,31 @@
+// multithreaded host versions of the vector kernels, for comparison
+
+#ifndef CPUVECTOR_H_
+#define CPUVECTOR_H_
+
+#include "reduce.h"
+#include <stddef.h>
+
+#define LLC_FALLBACK (32 << 20) // last level cache bytes when sysconf can't say
+
+// elementwise ops, named after the STREAM kernels they time
+typedef enum {
+  VECTOR_COPY,  // C = A
+  VECTOR_SCALE, // C = s * A
+  VECTOR_ADD,   // C = A + B
+  VECTOR_MULT,  // C = A * B
+  VECTOR_TRIAD  // C = A + s * B
+} vectorOp;
+
+// op over n doubles (isFloat 0) or floats of x, and y for dot. partial sums
+// are kept in double whatever the input precision.
+double cpuReduce(reduceOp op, int isFloat, const void *x, const void *y,
+                 size_t n, int threads);
+
+size_t llcBytes(void);
+void cpuVectorOp(vectorOp op, double *C, const double *A, const double *B,
+                 double s, size_t n, int threads);
+void cpuScan(int isInt, int inclusive, const void *in, void *out, size_t n,
+             int threads);
+
+#endif
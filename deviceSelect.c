@@ -0,0 +1,355 @@
+#include "deviceSelect.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void makeParents(char *path);
+
+// device spec from --device; overrides the environment
+static const char *deviceSpec = NULL;
+
+void setDeviceSpec(const char *spec) { deviceSpec = spec; }
+
+// specs:
+//   default        first GPU, else the first device of any type
+//   auto           fastest device by a calibration multiply, cached per host
+//   gpu|cpu|accelerator
+//                  first device of that type
+//   name:<text>    first device whose name contains text (any case)
+//   <p>:<d>        device d of platform p
+//   <d>            device d counting across all platforms
+const char *getDeviceSpec(void) {
+  if (deviceSpec) {
+    return deviceSpec;
+  }
+  const char *env = getenv(DEVICE_ENV);
+  return env && *env ? env : "default";
+}
+
+// case-insensitive strstr
+static int containsText(const char *haystack, const char *needle) {
+  size_t n = strlen(needle);
+  if (n == 0) {
+    return 1;
+  }
+  for (; *haystack; haystack++) {
+    size_t i = 0;
+    while (i < n && haystack[i] &&
+           tolower((unsigned char)haystack[i]) ==
+               tolower((unsigned char)needle[i])) {
+      i++;
+    }
+    if (i == n) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// platform & device index of a device in the getAllDevices list
+static void localIndex(cl_platform_id *platforms, cl_uint device,
+                       cl_uint *platform, cl_uint *index) {
+  *platform = 0;
+  *index = 0;
+  for (cl_uint d = 1; d <= device; d++) {
+    if (platforms[d] != platforms[d - 1]) {
+      (*platform)++;
+      *index = 0;
+    } else {
+      (*index)++;
+    }
+  }
+}
+
+static int firstOfType(cl_device_id *devices, cl_uint numDevices,
+                       cl_device_type type) {
+  for (cl_uint d = 0; d < numDevices; d++) {
+    cl_device_type t = 0;
+    clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(t), &t, NULL);
+    if (t & type) {
+      return d;
+    }
+  }
+  return -1;
+}
+
+static void deviceNames(cl_platform_id platformID, cl_device_id deviceID,
+                        char *platform, char *device, size_t size) {
+  platform[0] = '\0';
+  device[0] = '\0';
+  clGetPlatformInfo(platformID, CL_PLATFORM_NAME, size, platform, NULL);
+  clGetDeviceInfo(deviceID, CL_DEVICE_NAME, size, device, NULL);
+}
+
+void listDevices(void) {
+  cl_platform_id *platforms;
+  cl_device_id *devices;
+  cl_uint numDevices = getAllDevices(&platforms, &devices);
+  for (cl_uint d = 0; d < numDevices; d++) {
+    char platform[128], name[128];
+    cl_uint p, i;
+    deviceNames(platforms[d], devices[d], platform, name, sizeof(name));
+    localIndex(platforms, d, &p, &i);
+    printf("%2u  %u:%u  %s [%s]\n", d, p, i, name, platform);
+  }
+  free(platforms);
+  free(devices);
+}
+
+//-----------------auto selection-----------------
+// GFLOP/s of a small mult2 on one device, 0 if it cannot run it
+static double calibrate(cl_platform_id platformID, cl_device_id deviceID,
+                        const char *kernelSource, size_t kernelSize) {
+  const int n = CALIBRATION_N;
+  const size_t local[2] = {16, 16};
+  const size_t global[2] = {n, n};
+  size_t bytes = (size_t)n * n * sizeof(double);
+  cl_device_fp_config fp64 = 0;
+  clGetDeviceInfo(deviceID, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64,
+                  NULL);
+  if (!fp64) {
+    return 0.0;
+  }
+
+  cl_context context = NULL;
+  cl_command_queue commandQueue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem dA = NULL, dB = NULL, dC = NULL;
+  double best = 0.0;
+
+  // zeros keep denormals out of the timing
+  double *zeros = (double *)calloc((size_t)n * n, sizeof(double));
+  if (createContext(&context, &platformID, &deviceID) ||
+      createQueue(&commandQueue, &context, &deviceID, 0, 1) ||
+      createProgramFromSource(&program, &context, kernelSource,
+                              &kernelSize) ||
+      buildProgram(&program, &deviceID) ||
+      createKernel(&kernel, &program, "mult2") ||
+      createBuffer(&dA, bytes, CL_MEM_READ_ONLY, &context) ||
+      createBuffer(&dB, bytes, CL_MEM_READ_ONLY, &context) ||
+      createBuffer(&dC, bytes, CL_MEM_WRITE_ONLY, &context) ||
+      clEnqueueWriteBuffer(commandQueue, dA, CL_TRUE, 0, bytes, zeros, 0,
+                           NULL, NULL) ||
+      clEnqueueWriteBuffer(commandQueue, dB, CL_TRUE, 0, bytes, zeros, 0,
+                           NULL, NULL) ||
+      clSetKernelArg(kernel, 0, sizeof(int), &n) ||
+      clSetKernelArg(kernel, 1, sizeof(cl_mem), &dA) ||
+      clSetKernelArg(kernel, 2, sizeof(cl_mem), &dB) ||
+      clSetKernelArg(kernel, 3, sizeof(cl_mem), &dC)) {
+    goto cleanup;
+  }
+
+  // best of a few runs after one to warm up
+  for (int run = 0; run < 4; run++) {
+    cl_event done;
+    double nanoseconds;
+    if (clEnqueueNDRangeKernel(commandQueue, kernel, 2, NULL, global, local, 0,
+                               NULL, &done) != CL_SUCCESS) {
+      best = 0.0;
+      break;
+    }
+    clWaitForEvents(1, &done);
+    timeProf(&nanoseconds, done);
+    clReleaseEvent(done);
+    if (run > 0 && (best == 0.0 || nanoseconds < best)) {
+      best = nanoseconds;
+    }
+  }
+
+cleanup:
+  if (dA) {
+    clReleaseMemObject(dA);
+  }
+  if (dB) {
+    clReleaseMemObject(dB);
+  }
+  if (dC) {
+    clReleaseMemObject(dC);
+  }
+  if (kernel) {
+    clReleaseKernel(kernel);
+  }
+  if (program) {
+    clReleaseProgram(program);
+  }
+  if (commandQueue) {
+    clReleaseCommandQueue(commandQueue);
+  }
+  if (context) {
+    clReleaseContext(context);
+  }
+  free(zeros);
+  return best > 0.0 ? 2.0 * n * n * n / best : 0.0;
+}
+
+// path of a file in the cache directory, CLMM_CACHE_DIR or the usual
+// per-user cache, with the directories above it created
+void cachePath(char *path, size_t size, const char *file) {
+  const char *dir = getenv(CACHE_ENV);
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (dir && *dir) {
+    snprintf(path, size, "%s/%s", dir, file);
+  } else if (xdg && *xdg) {
+    snprintf(path, size, "%s/clmatmul/%s", xdg, file);
+  } else if (home && *home) {
+    snprintf(path, size, "%s/.cache/clmatmul/%s", home, file);
+  } else {
+    snprintf(path, size, "/tmp/clmatmul-%s", file);
+  }
+  makeParents(path);
+}
+
+// mkdir -p for the directories above a file
+static void makeParents(char *path) {
+  for (char *slash = strchr(path + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(path, 0755);
+    *slash = '/';
+  }
+}
+
+// device named in the cache file, -1 if there is none or it has gone
+static int cachedDevice(cl_platform_id *platforms, cl_device_id *devices,
+                        cl_uint numDevices, const char *path) {
+  char line[300];
+  FILE *cache = fopen(path, "r");
+  if (!cache) {
+    return -1;
+  }
+  char *ok = fgets(line, sizeof(line), cache);
+  fclose(cache);
+  if (!ok) {
+    return -1;
+  }
+  line[strcspn(line, "\n")] = '\0';
+  for (cl_uint d = 0; d < numDevices; d++) {
+    char platform[128], name[128], entry[300];
+    deviceNames(platforms[d], devices[d], platform, name, sizeof(name));
+    snprintf(entry, sizeof(entry), "%s\t%s", platform, name);
+    if (!strcmp(entry, line)) {
+      return d;
+    }
+  }
+  return -1;
+}
+
+// fastest device for a calibration multiply, remembered per host
+static int autoDevice(cl_platform_id *platforms, cl_device_id *devices,
+                      cl_uint numDevices) {
+  char host[64] = "localhost", file[80], path[512];
+  gethostname(host, sizeof(host));
+  host[sizeof(host) - 1] = '\0';
+  snprintf(file, sizeof(file), "device-%s", host);
+  cachePath(path, sizeof(path), file);
+  int chosen = cachedDevice(platforms, devices, numDevices, path);
+  if (chosen >= 0 || numDevices == 0) {
+    return chosen;
+  }
+
+  size_t kernelSize;
+  char *kernelSource = kernelFromFile(&kernelSize, "matrix.cl");
+  if (!kernelSource) {
+    return -1;
+  }
+  double best = 0.0;
+  for (cl_uint d = 0; d < numDevices; d++) {
+    char platform[128], name[128];
+    deviceNames(platforms[d], devices[d], platform, name, sizeof(name));
+    double gflops = calibrate(platforms[d], devices[d], kernelSource,
+                              kernelSize);
+    printf("\ncalibrated %s: %.2f GFLOP/s\n", name, gflops);
+    if (gflops > best) {
+      best = gflops;
+      chosen = d;
+    }
+  }
+  free(kernelSource);
+
+  if (chosen >= 0) {
+    char platform[128], name[128];
+    deviceNames(platforms[chosen], devices[chosen], platform, name,
+                sizeof(name));
+    FILE *cache = fopen(path, "w");
+    if (cache) {
+      fprintf(cache, "%s\t%s\n", platform, name);
+      fclose(cache);
+    }
+  }
+  return chosen;
+}
+
+//------------------------------------------------------------
+// pick a device by a spec, NULL for the one from --device or CLMM_DEVICE
+cl_int selectDevice(const char *spec, cl_platform_id *platformID,
+                    cl_device_id *deviceID) {
+  cl_platform_id *platforms;
+  cl_device_id *devices;
+  cl_uint numDevices = getAllDevices(&platforms, &devices);
+  if (!spec) {
+    spec = getDeviceSpec();
+  }
+  unsigned p, i;
+  char extra;
+  int chosen = -1;
+
+  if (!strcmp(spec, "default")) {
+    chosen = firstOfType(devices, numDevices, CL_DEVICE_TYPE_GPU);
+    if (chosen < 0 && numDevices > 0) {
+      chosen = 0;
+    }
+  } else if (!strcmp(spec, "auto")) {
+    chosen = autoDevice(platforms, devices, numDevices);
+  } else if (!strcmp(spec, "gpu")) {
+    chosen = firstOfType(devices, numDevices, CL_DEVICE_TYPE_GPU);
+  } else if (!strcmp(spec, "cpu")) {
+    chosen = firstOfType(devices, numDevices, CL_DEVICE_TYPE_CPU);
+  } else if (!strcmp(spec, "accelerator")) {
+    chosen = firstOfType(devices, numDevices, CL_DEVICE_TYPE_ACCELERATOR);
+  } else if (!strncmp(spec, "name:", 5)) {
+    for (cl_uint d = 0; d < numDevices && chosen < 0; d++) {
+      char platform[128], name[128];
+      deviceNames(platforms[d], devices[d], platform, name, sizeof(name));
+      if (containsText(name, spec + 5)) {
+        chosen = d;
+      }
+    }
+  } else if (sscanf(spec, "%u:%u%c", &p, &i, &extra) == 2) {
+    for (cl_uint d = 0; d < numDevices && chosen < 0; d++) {
+      cl_uint dp, di;
+      localIndex(platforms, d, &dp, &di);
+      if (dp == p && di == i) {
+        chosen = d;
+      }
+    }
+  } else if (sscanf(spec, "%u%c", &i, &extra) == 1 && i < numDevices) {
+    chosen = i;
+  }
+
+  if (numDevices == 0 || chosen < 0) {
+    if (numDevices == 0) {
+      fprintf(stderr, "no OpenCL devices found.\n");
+    } else {
+      fprintf(stderr, "no OpenCL device matches \"%s\". devices:\n", spec);
+      listDevices();
+    }
+    free(platforms);
+    free(devices);
+    return CL_DEVICE_NOT_FOUND;
+  }
+  *platformID = platforms[chosen];
+  *deviceID = devices[chosen];
+  if (VERBOSE) {
+    char platform[128], name[128];
+    deviceNames(*platformID, *deviceID, platform, name, sizeof(name));
+    printf("using %s [%s]\n", name, platform);
+  }
+  free(platforms);
+  free(devices);
+  return CL_SUCCESS;
+}
@@ -0,0 +1,23 @@
+// choose which OpenCL device getPlatformDevice hands out
+
+#ifndef DEVICESELECT_H_
+#define DEVICESELECT_H_
+
+#include "clHelper.h"
+
+#define DEVICE_ENV "CLMM_DEVICE"  // device spec when --device is not given
+#define CACHE_ENV "CLMM_CACHE_DIR" // where auto & program binaries are kept
+#define CALIBRATION_N 512          // size of the auto calibration multiply
+
+void setDeviceSpec(const char *spec);
+
+const char *getDeviceSpec(void);
+
+void listDevices(void);
+
+void cachePath(char *path, size_t size, const char *file);
+
+cl_int selectDevice(const char *spec, cl_platform_id *platformID,
+                    cl_device_id *deviceID);
+
+#endif
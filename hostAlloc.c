@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "hostAlloc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+typedef struct {
+  void *start;
+  size_t length;
+} hugeMap;
+
+static int chosen = -1; // hostPages, or -1 until first use
+static hugeMap maps[HOST_MAPS];
+static size_t mappedBytes;
+static pthread_mutex_t mapLock = PTHREAD_MUTEX_INITIALIZER;
+
+// CLMM_HUGEPAGES if set, otherwise transparent huge pages
+hostPages defaultPages(void) {
+  const char *env = getenv(PAGES_ENV);
+  if (env && !strcmp(env, "off")) {
+    return PAGES_SMALL;
+  }
+  if (env && !strcmp(env, "explicit")) {
+    return PAGES_EXPLICIT;
+  }
+  return PAGES_TRANSPARENT;
+}
+
+// pages for arrays allocated from now on; ones already out keep theirs
+void setHostPages(hostPages pages) { chosen = pages; }
+
+const char *pagesName(hostPages pages) {
+  const char *names[] = {"4 KiB", "transparent huge", "explicit huge"};
+  return names[pages];
+}
+
+static size_t roundUp(size_t size, size_t to) {
+  return (size + to - 1) / to * to;
+}
+
+// hugetlbfs pages from the reserved pool (vm.nr_hugepages). NULL when the
+// pool is empty or the table of live maps is full.
+static void *mapHuge(size_t length) {
+#ifdef MAP_HUGETLB
+  void *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  pthread_mutex_lock(&mapLock);
+  for (int m = 0; m < HOST_MAPS; m++) {
+    if (!maps[m].start) {
+      maps[m].start = p;
+      maps[m].length = length;
+      mappedBytes += length;
+      pthread_mutex_unlock(&mapLock);
+      return p;
+    }
+  }
+  pthread_mutex_unlock(&mapLock);
+  munmap(p, length);
+#endif
+  (void)length;
+  return NULL;
+}
+
+// size bytes starting on a HOST_ALIGN boundary, so on a cache line and a
+// page, or NULL. arrays of a huge page or more are padded to whole huge
+// pages and, depending on CLMM_HUGEPAGES, mapped from the hugetlbfs pool
+// or aligned to 2 MiB & marked for transparent huge pages. explicit falls
+// back to transparent, which the kernel may in turn back with small pages.
+void *hostAlloc(size_t size) {
+  hostPages pages = chosen < 0 ? defaultPages() : (hostPages)chosen;
+  void *p = NULL;
+  if (size == 0) {
+    size = 1;
+  }
+  if (size < HUGE_PAGE) {
+    return posix_memalign(&p, HOST_ALIGN, size) ? NULL : p;
+  }
+
+  size_t length = roundUp(size, HUGE_PAGE);
+  if (pages == PAGES_EXPLICIT && (p = mapHuge(length))) {
+    return p;
+  }
+  if (posix_memalign(&p, pages == PAGES_SMALL ? HOST_ALIGN : HUGE_PAGE,
+                     length)) {
+    return NULL;
+  }
+  // with THP set to always, small pages have to be asked for too
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+  madvise(p, length, pages == PAGES_SMALL ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+#endif
+  return p;
+}
+
+void hostFree(void *p) {
+  if (!p) {
+    return;
+  }
+  pthread_mutex_lock(&mapLock);
+  for (int m = 0; m < HOST_MAPS; m++) {
+    if (maps[m].start == p) {
+      munmap(p, maps[m].length);
+      mappedBytes -= maps[m].length;
+      maps[m].start = NULL;
+      pthread_mutex_unlock(&mapLock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&mapLock);
+  free(p);
+}
+
+// bytes of this process on huge pages: transparent ones as the kernel counts
+// them in smaps_rollup, plus the explicit maps
+size_t hugeBytes(void) {
+  char line[256];
+  size_t kB = 0;
+  FILE *smaps = fopen("/proc/self/smaps_rollup", "r");
+  while (smaps && fgets(line, sizeof(line), smaps)) {
+    if (sscanf(line, "AnonHugePages: %zu kB", &kB) == 1) {
+      break;
+    }
+  }
+  if (smaps) {
+    fclose(smaps);
+  }
+  pthread_mutex_lock(&mapLock);
+  size_t total = kB * 1024 + mappedBytes;
+  pthread_mutex_unlock(&mapLock);
+  return total;
+}
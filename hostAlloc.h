@@ -0,0 +1,23 @@
+// aligned host arrays, backed by huge pages when they are big enough
+
+#ifndef HOSTALLOC_H_
+#define HOSTALLOC_H_
+
+#include <stddef.h>
+
+#define PAGES_ENV "CLMM_HUGEPAGES" // off, thp (default) or explicit
+#define HOST_ALIGN 4096            // every array starts on a page & line
+#define HUGE_PAGE (2 << 20)        // arrays this big get huge pages
+#define HOST_MAPS 64               // explicit huge page arrays alive at once
+
+typedef enum { PAGES_SMALL, PAGES_TRANSPARENT, PAGES_EXPLICIT } hostPages;
+
+hostPages defaultPages(void);
+void setHostPages(hostPages pages);
+const char *pagesName(hostPages pages);
+
+void *hostAlloc(size_t size);
+void hostFree(void *p);
+size_t hugeBytes(void);
+
+#endif
@@ -0,0 +1,207 @@
+#include "hwCounters.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define PARANOID_PATH "/proc/sys/kernel/perf_event_paranoid"
+
+static int warned;
+
+// CLMM_COUNTERS set to anything but 0
+int countersWanted(void) {
+  const char *env = getenv(COUNTERS_ENV);
+  return env && *env && strcmp(env, "0");
+}
+
+// FP_ARITH_INST_RETIRED exists on Intel cores since Broadwell; there is no
+// generic perf event for floating point work. Broadwell is the first family 6
+// core with ADX, which Haswell & the Silvermont & Goldmont atoms lack; the
+// Knights Landing & Mill Xeon Phis have ADX but not the event.
+static int hasFpArith(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx) || eax < 7 ||
+      ebx != 0x756e6547 || edx != 0x49656e69 ||
+      ecx != 0x6c65746e) { // "GenuineIntel"
+    return 0;
+  }
+  __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+  unsigned int family = (eax >> 8) & 0xf;
+  unsigned int model = ((eax >> 4) & 0xf) | ((eax >> 12) & 0xf0);
+  if (family != 6 || model == 0x57 || model == 0x85) {
+    return 0;
+  }
+  __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+  return (ebx >> 19) & 1; // ADX
+#else
+  return 0;
+#endif
+}
+
+#ifdef __linux__
+static int openEvent(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.inherit = 1; // parallelFor's threads are counted as they exit
+  attr.exclude_kernel = 1; // allowed up to perf_event_paranoid 2
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cacheMiss(uint64_t cache) {
+  return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+         PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+}
+#endif
+
+// opens & starts whichever events this process may count. with
+// CLMM_COUNTERS unset, or none of them available, every fd stays -1.
+void countersStart(hwCounters *c) {
+  memset(c, 0, sizeof(*c));
+  for (int e = 0; e < COUNTERS; e++) {
+    c->fds[e] = -1;
+  }
+  if (!countersWanted()) {
+    return;
+  }
+#ifdef __linux__
+  const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[COUNTERS] = {
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1D)},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB)},
+      {PERF_TYPE_RAW, 0x01c7}, // event c7, umask scalar double
+      {PERF_TYPE_RAW, 0x04c7}, // 128 bit packed double
+      {PERF_TYPE_RAW, 0x10c7}, // 256 bit packed double
+      {PERF_TYPE_RAW, 0x40c7}, // 512 bit packed double
+  };
+  int fp = hasFpArith(), cyclesErr = 0;
+  for (int e = 0; e < COUNTERS; e++) {
+    if (e < COUNT_FP_SCALAR || fp) {
+      c->fds[e] = openEvent(events[e].type, events[e].config);
+    }
+    if (e == COUNT_CYCLES) {
+      cyclesErr = errno;
+    }
+  }
+  if (c->fds[COUNT_CYCLES] < 0 && !warned) {
+    int paranoid = -1;
+    FILE *f = fopen(PARANOID_PATH, "r");
+    if (f) {
+      if (fscanf(f, "%d", &paranoid) != 1) {
+        paranoid = -1;
+      }
+      fclose(f);
+    }
+    fprintf(stderr,
+            "hardware counters unavailable: %s (perf_event_paranoid %d)\n",
+            strerror(cyclesErr), paranoid);
+    warned = 1;
+  }
+  for (int e = 0; e < COUNTERS; e++) {
+    if (c->fds[e] >= 0) {
+      ioctl(c->fds[e], PERF_EVENT_IOC_RESET, 0);
+      ioctl(c->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+// stops, reads & closes the events. a count from an event that shared its
+// hardware counter with others is scaled by enabled / running time.
+void countersStop(hwCounters *c) {
+#ifdef __linux__
+  for (int e = 0; e < COUNTERS; e++) {
+    if (c->fds[e] >= 0) {
+      ioctl(c->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for (int e = 0; e < COUNTERS; e++) {
+    uint64_t v[3]; // value, time enabled, time running
+    if (c->fds[e] < 0) {
+      continue;
+    }
+    if (read(c->fds[e], v, sizeof(v)) == (ssize_t)sizeof(v) && v[2] > 0) {
+      c->values[e] = (double)v[0];
+      if (v[2] < v[1]) {
+        c->values[e] *= (double)v[1] / v[2];
+        c->multiplexed = 1;
+      }
+    }
+    close(c->fds[e]);
+    c->fds[e] = -2; // was counted
+  }
+#else
+  (void)c;
+#endif
+}
+
+static void perFlop(const hwCounters *c, counterId e, const char *name,
+                    double flops) {
+  const char *sep = e == COUNT_INSTRUCTIONS ? " " : ", ";
+  if (c->fds[e] == -2 && flops > 0.0) {
+    printf("%s%s %.4g", sep, name, c->values[e] / flops);
+  } else {
+    printf("%s%s -", sep, name);
+  }
+}
+
+// one line of totals and IPC, one of events per flop; "-" where an event
+// was not counted. nothing when no counter was.
+void countersReport(const hwCounters *c, const char *label, double flops) {
+  if (c->fds[COUNT_CYCLES] != -2) {
+    return;
+  }
+  double cycles = c->values[COUNT_CYCLES];
+  double instructions = c->values[COUNT_INSTRUCTIONS];
+  printf("%s counters%s: %.4g cycles", label,
+         c->multiplexed ? " (multiplexed)" : "", cycles);
+  if (c->fds[COUNT_INSTRUCTIONS] == -2 && cycles > 0.0) {
+    printf(", %.4g instructions, IPC %.2f\n", instructions,
+           instructions / cycles);
+  } else {
+    printf("\n");
+  }
+
+  printf("%s per flop:", label);
+  perFlop(c, COUNT_INSTRUCTIONS, "instructions", flops);
+  perFlop(c, COUNT_L1D_MISSES, "L1d misses", flops);
+  perFlop(c, COUNT_LLC_MISSES, "LLC misses", flops);
+  perFlop(c, COUNT_DTLB_MISSES, "dTLB misses", flops);
+  // each fp instruction does one double per lane; fma is counted twice
+  const int lanes[] = {1, 2, 4, 8};
+  int fpCounted = 0;
+  double fpOps = 0.0;
+  for (int w = 0; w < 4; w++) {
+    if (c->fds[COUNT_FP_SCALAR + w] == -2) {
+      fpOps += lanes[w] * c->values[COUNT_FP_SCALAR + w];
+      fpCounted = 1;
+    }
+  }
+  if (fpCounted && flops > 0.0) {
+    printf(", fp ops %.4g\n", fpOps / flops);
+  } else {
+    printf(", fp ops -\n");
+  }
+}
@@ -0,0 +1,34 @@
+// hardware performance counters around host code, through perf_event_open.
+// opt-in with CLMM_COUNTERS; events the kernel or CPU won't give are left
+// out of the report instead of failing the run.
+
+#ifndef HWCOUNTERS_H_
+#define HWCOUNTERS_H_
+
+#define COUNTERS_ENV "CLMM_COUNTERS" // set (and not 0) to read the counters
+
+typedef enum {
+  COUNT_CYCLES,
+  COUNT_INSTRUCTIONS,
+  COUNT_L1D_MISSES, // L1 data cache read misses
+  COUNT_LLC_MISSES, // last level cache misses
+  COUNT_DTLB_MISSES,
+  COUNT_FP_SCALAR, // retired double precision fp instructions by width,
+  COUNT_FP_128,    // Intel only
+  COUNT_FP_256,
+  COUNT_FP_512,
+  COUNTERS
+} counterId;
+
+typedef struct {
+  int fds[COUNTERS];       // -1 where the event is not counted
+  double values[COUNTERS]; // scaled up where the event was multiplexed
+  int multiplexed;
+} hwCounters;
+
+int countersWanted(void);
+void countersStart(hwCounters *c);
+void countersStop(hwCounters *c);
+void countersReport(const hwCounters *c, const char *label, double flops);
+
+#endif
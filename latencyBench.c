@@ -0,0 +1,139 @@
+// latency of a multiply through libclmatmul in-process against spawning
+// matrixOp for every multiply
+
+#include "clmatmul.h"
+#include "hostAlloc.h"
+#include "parallel.h"
+#include "philox.h"
+#include "timer.h"
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static void fillRandom(double *M, int n, unsigned stream) {
+  randomFill(M, (size_t)n * n, 0.0, 1.0, defaultSeed(), stream,
+             defaultThreads());
+}
+
+static void report(const char *what, double *ms, int reps) {
+  double min = ms[0], total = 0.0;
+  for (int r = 0; r < reps; r++) {
+    total += ms[r];
+    min = ms[r] < min ? ms[r] : min;
+  }
+  printf("%-28s mean %10.3f ms  min %10.3f ms\n", what, total / reps, min);
+}
+
+// run matrixOp for one multiply with its output thrown away
+static int spawnOnce(const char *exe, const char *size) {
+  char *args[] = {(char *)exe, "--n",        (char *)size, "--kernel",
+                  "mult2",     "--no-check", NULL};
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  pid_t pid;
+  int status = -1;
+  if (posix_spawn(&pid, exe, &actions, NULL, args, environ) == 0) {
+    waitpid(pid, &status, 0);
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : 256;
+  int reps = argc > 2 ? atoi(argv[2]) : 20;
+  const char *exe = argc > 3 ? argv[3] : "./matrixOp";
+  if (n < 1 || reps < 1) {
+    fprintf(stderr, "usage: clmmLatency [n] [reps] [matrixOp path]\n");
+    return 1;
+  }
+  size_t bytes = (size_t)n * n * sizeof(double);
+  double *ms = (double *)malloc(reps * sizeof(double));
+  double **A = (double **)malloc(reps * sizeof(double *));
+  double **B = (double **)malloc(reps * sizeof(double *));
+  double **C = (double **)malloc(reps * sizeof(double *));
+  char size[16];
+  snprintf(size, sizeof(size), "%d", n);
+  for (int r = 0; r < reps; r++) {
+    A[r] = (double *)hostAlloc(bytes);
+    B[r] = (double *)hostAlloc(bytes);
+    C[r] = (double *)hostAlloc(bytes);
+    fillRandom(A[r], n, 2 * r);
+    fillRandom(B[r], n, 2 * r + 1);
+  }
+  printf("%dx%d multiply, %d repetitions\n", n, n, reps);
+
+  // one-off cost a service pays once
+  clmmContext *ctx;
+  double start = wallTime();
+  int err = clmmInit(&ctx, NULL);
+  double init = (wallTime() - start) * 1000.0;
+  if (err) {
+    fprintf(stderr, "clmmInit failed: %s\n", clmmErrorString(err));
+  } else {
+    printf("%-28s %15.3f ms\n", "clmmInit", init);
+
+    // the first call also allocates the device buffers
+    err = clmmGemm(ctx, n, A[0], B[0], C[0]);
+    for (int r = 0; r < reps && !err; r++) {
+      start = wallTime();
+      err = clmmGemm(ctx, n, A[r], B[r], C[r]);
+      ms[r] = (wallTime() - start) * 1000.0;
+    }
+    if (err) {
+      fprintf(stderr, "clmmGemm failed: %s\n", clmmErrorString(err));
+    } else {
+      report("in-process clmmGemm", ms, reps);
+    }
+
+    start = wallTime();
+    int batchErr = clmmGemmBatched(ctx, n, reps, (const double *const *)A,
+                                   (const double *const *)B, C);
+    ms[0] = (wallTime() - start) * 1000.0 / reps;
+    if (batchErr) {
+      fprintf(stderr, "clmmGemmBatched failed: %s\n",
+              clmmErrorString(batchErr));
+      err = err ? err : batchErr;
+    } else {
+      printf("%-28s %15.3f ms per product\n", "in-process clmmGemmBatched",
+             ms[0]);
+    }
+    clmmShutdown(ctx);
+  }
+
+  // a failing spawn ends the runs, and the ones before it are reported
+  int spawned = reps;
+  for (int r = 0; r < reps; r++) {
+    start = wallTime();
+    int status = spawnOnce(exe, size);
+    ms[r] = (wallTime() - start) * 1000.0;
+    if (status != 0) {
+      fprintf(stderr, "%s exited with status %d\n", exe, status);
+      spawned = r;
+      break;
+    }
+  }
+  if (spawned > 0) {
+    report("spawned matrixOp", ms, spawned);
+  }
+
+  for (int r = 0; r < reps; r++) {
+    hostFree(A[r]);
+    hostFree(B[r]);
+    hostFree(C[r]);
+  }
+  free(A);
+  free(B);
+  free(C);
+  free(ms);
+  return err != 0;
+}
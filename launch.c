@@ -0,0 +1,224 @@
+#include "launch.h"
+#include "bench.h"
+#include "parallel.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// one condition: every thread launches perThread times on its own queue &
+// kernel object, since clSetKernelArg is not thread safe on a shared one
+typedef struct {
+  cl_command_queue *queues;
+  cl_kernel *kernels;
+  const size_t *local; // from the kernel's resources, NULL for the driver's
+  int perThread;
+  int batched;       // flush every LAUNCH_BATCH & finish once, else finish each
+  cl_event *events;  // perThread per thread, NULL when launched without
+  double *seconds;   // per thread, its whole loop
+  cl_int *errs;      // per thread
+} launchRun;
+
+static const size_t launchGlobal[2] = {LAUNCH_GEMM, LAUNCH_GEMM};
+
+static void launchThread(size_t begin, size_t end, int thread, void *arg) {
+  launchRun *run = (launchRun *)arg;
+  cl_command_queue q = run->queues[thread];
+  cl_kernel kernel = run->kernels[thread];
+  cl_event *events = run->events ? run->events + thread * run->perThread : NULL;
+  cl_int err = CL_SUCCESS;
+  (void)begin;
+  (void)end;
+
+  double start = wallTime();
+  for (int i = 0; i < run->perThread && !err; i++) {
+    err = clEnqueueNDRangeKernel(q, kernel, 2, NULL, launchGlobal,
+                                 run->local, 0, NULL,
+                                 events ? &events[i] : NULL);
+    if (!err && !run->batched) {
+      err = clFinish(q);
+    } else if (!err && (i + 1) % LAUNCH_BATCH == 0) {
+      err = clFlush(q);
+    }
+  }
+  if (!err) {
+    err = clFinish(q);
+  }
+  run->seconds[thread] = wallTime() - start;
+  run->errs[thread] = err;
+}
+
+// queued -> start of every launch that has an event, in seconds, releasing
+// the events. returns how many there were.
+static int launchLatency(cl_event *events, int count, double *latency) {
+  int timed = 0;
+  for (int i = 0; i < count; i++) {
+    cl_ulong queued, start;
+    if (!events[i]) {
+      continue;
+    }
+    if (!clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_QUEUED,
+                                 sizeof(queued), &queued, NULL) &&
+        !clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START,
+                                 sizeof(start), &start, NULL)) {
+      latency[timed++] = (start - queued) * 1e-9;
+    }
+    clReleaseEvent(events[i]);
+  }
+  return timed;
+}
+
+// one row of the table: a kernel launched count times over threads host
+// threads, each with its own queue, after LAUNCH_BATCH untimed launches a
+// thread. the rate is over the slowest thread's loop.
+static cl_int launchCondition(runtime *rt, const char *file, const char *name,
+                              int isGemm, cl_mem *buffers, int outOfOrder,
+                              int withEvents, int batched, int threads,
+                              int count) {
+  cl_int err = CL_SUCCESS;
+  int perThread = count / threads > 0 ? count / threads : 1;
+  int total = perThread * threads;
+  kernelResources resources;
+  size_t local[2];
+  launchRun run = {NULL, NULL, NULL, perThread, batched, NULL, NULL, NULL};
+  run.queues = (cl_command_queue *)calloc(threads, sizeof(cl_command_queue));
+  run.kernels = (cl_kernel *)calloc(threads, sizeof(cl_kernel));
+  run.seconds = (double *)calloc(threads, sizeof(double));
+  run.errs = (cl_int *)calloc(threads, sizeof(cl_int));
+  double *latency = (double *)malloc(total * sizeof(double));
+  if (withEvents) {
+    run.events = (cl_event *)calloc(total, sizeof(cl_event));
+  }
+  if (!run.queues || !run.kernels || !run.seconds || !run.errs || !latency ||
+      (withEvents && !run.events)) {
+    err = CL_OUT_OF_HOST_MEMORY;
+  }
+  // out of order execution is optional; ask before the driver refuses it
+  cl_command_queue_properties props = 0;
+  if (!err && outOfOrder &&
+      !clGetDeviceInfo(rt->deviceID, CL_DEVICE_QUEUE_ON_HOST_PROPERTIES,
+                       sizeof(props), &props, NULL) &&
+      !(props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)) {
+    err = CL_INVALID_QUEUE_PROPERTIES;
+  }
+
+  // profiling only where events are asked for, so the rest pay nothing
+  for (int t = 0; t < threads && !err; t++) {
+    if ((err = createQueue(&run.queues[t], &rt->context, &rt->deviceID,
+                           outOfOrder, withEvents)) ||
+        (err = runtimeKernel(rt, file, name, &run.kernels[t]))) {
+      break;
+    }
+    if (isGemm) {
+      err = setArgs(&run.kernels[t], LAUNCH_GEMM, buffers[0], buffers[1],
+                    buffers[2]);
+    }
+    if (!err && t == 0 &&
+        !(err = kernelInfo(run.kernels[0], rt->deviceID, &resources))) {
+      run.local = kernelLocal(&resources, LAUNCH_GEMM, LAUNCH_GEMM, local);
+    }
+    for (int i = 0; i < LAUNCH_BATCH && !err; i++) {
+      err = clEnqueueNDRangeKernel(run.queues[t], run.kernels[t], 2, NULL,
+                                   launchGlobal, run.local, 0, NULL, NULL);
+    }
+    if (!err) {
+      err = clFinish(run.queues[t]);
+    }
+  }
+
+  if (!err) {
+    parallelFor(threads, threads, launchThread, &run);
+    double slowest = 0.0;
+    for (int t = 0; t < threads; t++) {
+      err = err ? err : run.errs[t];
+      slowest = run.seconds[t] > slowest ? run.seconds[t] : slowest;
+    }
+    printf("%-6s %-5s %-6s %-6s %7d %12.0f %10.2f", name,
+           outOfOrder ? "out" : "in", withEvents ? "yes" : "no",
+           batched ? "batch" : "each", threads, total / slowest,
+           slowest / perThread * 1e6);
+    int timed = withEvents ? launchLatency(run.events, total, latency) : 0;
+    if (timed > 0) {
+      benchStats stats;
+      benchSummarize(latency, timed, &stats);
+      printf(" %9.2f %9.2f %9.2f\n", stats.min * 1e6, stats.median * 1e6,
+             stats.p95 * 1e6);
+    } else {
+      printf(" %9s %9s %9s\n", "-", "-", "-");
+    }
+    checkErr(err, "timed launches");
+  } else if (err == CL_INVALID_QUEUE_PROPERTIES && outOfOrder) {
+    // a device without out of order queues skips its rows, not the table
+    printf("%-6s %-5s %-6s %-6s %7d %12s\n", name, "out",
+           withEvents ? "yes" : "no", batched ? "batch" : "each", threads,
+           "unsupported");
+    err = CL_SUCCESS;
+  } else if (run.events) {
+    launchLatency(run.events, total, latency);
+  }
+
+  for (int t = 0; run.queues && t < threads; t++) {
+    if (run.kernels[t]) {
+      clReleaseKernel(run.kernels[t]);
+    }
+    if (run.queues[t]) {
+      clReleaseCommandQueue(run.queues[t]);
+    }
+  }
+  free(run.queues);
+  free(run.kernels);
+  free(run.seconds);
+  free(run.errs);
+  free(run.events);
+  free(latency);
+  return err;
+}
+
+// every combination of kernel, queue order, events, finishing & threads.
+// count launches per condition are split over the threads; threads 1 only
+// runs the single threaded rows.
+cl_int runLaunch(runtime *rt, int count, int threads) {
+  const size_t bytes = LAUNCH_GEMM * LAUNCH_GEMM * sizeof(double);
+  cl_mem buffers[3] = {NULL, NULL, NULL};
+  cl_int err = CL_SUCCESS;
+  for (int b = 0; b < 3 && !err; b++) {
+    err = runtimeBuffer(rt, bytes, CL_MEM_READ_WRITE, &buffers[b]);
+  }
+  if (!err) {
+    // the multiply reads whatever is in A & B; only its launch matters
+    double zero = 0.0;
+    for (int b = 0; b < 3 && !err; b++) {
+      err = clEnqueueFillBuffer(rt->queues[0], buffers[b], &zero,
+                                sizeof(zero), 0, bytes, 0, NULL, NULL);
+    }
+    err = err ? err : clFinish(rt->queues[0]);
+  }
+
+  char name[256];
+  clGetDeviceInfo(rt->deviceID, CL_DEVICE_NAME, sizeof(name), name, NULL);
+  printf("launches on %s, %d per condition, %dx%d work-items\n", name, count,
+         LAUNCH_GEMM, LAUNCH_GEMM);
+  printf("%-6s %-5s %-6s %-6s %7s %12s %10s %9s %9s %9s\n", "kernel",
+         "queue", "events", "finish", "threads", "launches/s", "us/launch",
+         "q->s min", "median", "p95");
+  const int threadCounts[2] = {1, threads};
+  for (int g = 0; g < 2 && !err; g++) {
+    for (int t = 0; t < (threads > 1 ? 2 : 1) && !err; t++) {
+      for (int order = 0; order < 2 && !err; order++) {
+        for (int events = 1; events >= 0 && !err; events--) {
+          for (int batched = 0; batched < 2 && !err; batched++) {
+            err = launchCondition(rt, g ? "matrix.cl" : "launch.cl",
+                                  g ? "mult2" : "empty", g, buffers, order,
+                                  events, batched, threadCounts[t], count);
+          }
+        }
+      }
+    }
+  }
+  for (int b = 0; b < 3; b++) {
+    if (buffers[b]) {
+      runtimeRecycle(rt, buffers[b]);
+    }
+  }
+  return err;
+}
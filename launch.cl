@@ -0,0 +1,4 @@
+//Launch overhead microkernel: does nothing, so only the launch is timed
+
+__kernel void empty(){
+}
@@ -0,0 +1,17 @@
+// kernel launch overhead & queue submission rate of the runtime's device:
+// empty & tiny multiply launches under different queue, event, flush and
+// threading choices
+
+#ifndef LAUNCH_H_
+#define LAUNCH_H_
+
+#include "runtime.h"
+
+#define LAUNCH_COUNT 4096 // timed launches per condition, over all threads
+#define LAUNCH_BATCH 64   // launches between flushes when batched
+#define LAUNCH_THREADS 4  // host threads of the multithreaded runs
+#define LAUNCH_GEMM 16    // size of the tiny multiply, one work-group
+
+cl_int runLaunch(runtime *rt, int count, int threads);
+
+#endif
@@ -18,7 +18,9 @@ __kernel void mult(const int N, const __global double* A, const __global double*
 }
 
 //use tiled local memory to speed up multiplication
-__kernel void mult2(const int N, const __global double* A, const __global double * B, __global double* C){
+//the tiles are 16x16, so the work-groups have to be too
+__kernel __attribute__((reqd_work_group_size(16, 16, 1)))
+void mult2(const int N, const __global double* A, const __global double * B, __global double* C){
 	const int threadSize = 16;
 	//thread IDs
 	const int row = get_local_id(0);//LOCAL row ID
@@ -1,24 +1,84 @@
 #define CL_TARGET_OPENCL_VERSION 200
 
+#include "bench.h"
 #include "clHelper.h"
+#include "clmatmul.h"
+#include "deviceSelect.h"
+#include "hostAlloc.h"
+#include "hwCounters.h"
+#include "parallel.h"
+#include "roofline.h"
+#include "timer.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-// multiply matrices on CPU
-void matrixMultiply(const double *A, const double *B, double *C) {
-  for (int i = 0; i < N; i++) {
-    for (int j = 0; j < N; j++) {
+#define BENCH_SIZES "256,512,1024,2048" // sizes matrixOp bench runs by default
+#define BENCH_WARMUP 2    // untimed runs before each kernel's samples
+#define BENCH_REPS 10     // timed runs per kernel & size
+#define BENCH_CPU_MAX 1024 // largest size the naive CPU path is timed at
+#define MAX_BENCH_SIZES 32
+#define SWEEP_SIZES "64,128,256,512,1024,2048" // sizes matrixOp sweep runs
+#define SWEEP_WARMUP 1
+#define SWEEP_REPS 3
+#define SWEEP_PEAK 0.9       // within 10% of a curve's best is its plateau
+#define SWEEP_DROP 0.85      // 15% under the best at smaller n is a drop
+#define SWEEP_EFFICIENCY 0.7 // threads under 70% parallel efficiency
+#define MAX_SWEEP_THREADS 16
+
+typedef struct {
+  const double *A, *B;
+  double *C;
+  int n;
+} multiplyJob;
+
+static void multiplyRows(size_t begin, size_t end, int thread, void *arg) {
+  multiplyJob *job = (multiplyJob *)arg;
+  const double *A = job->A, *B = job->B;
+  int n = job->n;
+  (void)thread;
+  for (int i = (int)begin; i < (int)end; i++) {
+    for (int j = 0; j < n; j++) {
       double accumulator = 0.0;
-      for (int k = 0; k < N; k++) {
-        accumulator += A[k * N + i] * B[j * N + k];
+      for (int k = 0; k < n; k++) {
+        accumulator += A[k * n + i] * B[j * n + k];
       }
-      C[j * N + i] = accumulator;
+      job->C[j * n + i] = accumulator;
     }
   }
 }
 
+// multiply matrices on CPU, the rows of C split across threads
+void matrixMultiplyThreads(const double *A, const double *B, double *C, int n,
+                           int threads) {
+  multiplyJob job = {A, B, C, n};
+  parallelFor(n, threads, multiplyRows, &job);
+}
+
+void matrixMultiply(const double *A, const double *B, double *C, int n) {
+  matrixMultiplyThreads(A, B, C, n, 1);
+}
+
+// comma separated positive integers into values. returns how many, or -1
+// if the list has anything else in it.
+static int parseList(const char *list, int *values, int max) {
+  int count = 0;
+  for (const char *p = list; *p && count < max;) {
+    char *end;
+    long value = strtol(p, &end, 0);
+    if (end == p || value < 1) {
+      fprintf(stderr, "bad list %s\n", list);
+      return -1;
+    }
+    values[count++] = (int)value;
+    p = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
 double rms(double *A, double *B, int n) {
   int square = 0;
   double mean = 0.0, root = 0.0;
@@ -31,8 +91,8 @@ double rms(double *A, double *B, int n) {
   return root;
 }
 
-int checkEq(const double *A, const double *B) {
-  for (int i = 0; i < N * N; i++) {
+int checkEq(const double *A, const double *B, int n) {
+  for (size_t i = 0; i < (size_t)n * n; i++) {
     if (fabs(A[i] - B[i]) > 0.00001) {
       return 0;
     }
@@ -41,46 +101,633 @@ int checkEq(const double *A, const double *B) {
 }
 
 // use matrix mult function to benchmark CPU vs GPU performance & results
-void cpuBench(const double *A, const double *B, const double *C) {
-  double *testC = (double *)malloc(N * N * sizeof(double));
+void cpuBench(const double *A, const double *B, const double *C, int n) {
+  double *testC = (double *)hostAlloc((size_t)n * n * sizeof(double));
+  if (!testC) {
+    fprintf(stderr, "not enough host memory to check %dx%d on the CPU\n", n,
+            n);
+    return;
+  }
 
   printf("multiplying on CPU...\n");
-  clock_t start = clock();
-  matrixMultiply(A, B, testC);
-  clock_t end = clock();
-  double cpuTime = (double)(end - start) / CLOCKS_PER_SEC;
+  hwCounters counters;
+  countersStart(&counters);
+  double start = wallTime();
+  matrixMultiply(A, B, testC, n);
+  double cpuTime = wallTime() - start;
+  countersStop(&counters);
   printf("finished multiplying. Time taken: %3f seconds\n", cpuTime);
+  countersReport(&counters, "cpu", 2.0 * n * n * (double)n);
 
   // FILE *outfile;
   // int i;
 
   printf("verification...\n");
-  if (checkEq(C, testC)) {
+  if (checkEq(C, testC, n)) {
     printf("All values agree");
   } else {
     printf("discrepancy found");
   }
-  free(testC);
+  hostFree(testC);
 }
 
-void main(int argc, char *argv[]) {
+// run one kernel the way the options ask, all through libclmatmul: a plain
+// clmmGemm by default, panelled, across every device, or with a per-phase
+// breakdown. when the device runs out of memory or resources the multiply is
+// retried in ever smaller panels on one queue, and when nothing on the
+// device works it is done on the CPU. returns the last device error,
+// CL_SUCCESS if the device produced C.
+cl_int multiply(clmmContext **ctx, double *hA, double *hB, double *hC, int n,
+                char *func, int panelCols, int numQueues, int multi,
+                int breakdown) {
+  cl_int err;
+  initHost(hA, hB, n);
+  if (multi) {
+    err = clmmGemmAllDevices(func, n, hA, hB, hC,
+                             panelCols > 0 ? panelCols : 64);
+  } else if (!(err = *ctx ? CL_SUCCESS : clmmInit(ctx, NULL)) &&
+             !(err = clmmSetKernel(*ctx, func))) {
+    if (breakdown) {
+      err = clmmGemmBreakdown(*ctx, n, hA, hB, hC);
+    } else if (panelCols > 0) {
+      err = clmmGemmPanels(*ctx, n, hA, hB, hC, panelCols, numQueues);
+    } else if (!(err = clmmGemm(*ctx, n, hA, hB, hC))) {
+      printf("kernel matrix.cl:%s run in %f milliseconds\n", func,
+             clmmLastKernelTime(*ctx));
+    }
+  }
 
-  // setup randomization & error return
-  time_t t;
-  srand((unsigned)time(&t));
-  size_t bytes = N * N * sizeof(double *);
+  for (int cols = n / 2; isResourceError(err) && cols >= 16; cols /= 2) {
+    if ((!*ctx && clmmInit(ctx, NULL)) || clmmSetKernel(*ctx, func)) {
+      break;
+    }
+    fprintf(stderr, "retrying %s in panels of %d columns\n", func, cols);
+    clmmTrim(*ctx);
+    err = clmmGemmPanels(*ctx, n, hA, hB, hC, cols, 1);
+  }
+  if (err != CL_SUCCESS) {
+    fprintf(stderr, "falling back to the CPU for %s\n", func);
+    matrixMultiply(hA, hB, hC, n);
+  }
+  return err;
+}
+
+// what the device compiler made of each kernel about to be timed, so a
+// variant that spills or runs out of local memory shows before its times
+void kernelReport(clmmContext *ctx, char **names, int count, int n) {
+  for (int k = 0; k < count; k++) {
+    clmmKernelResources r;
+    if (clmmKernelInfo(ctx, names[k], n, &r)) {
+      continue;
+    }
+    if (k == 0) {
+      printf("matrix.cl built or loaded in %.1f ms, launches at n %d\n",
+             r.buildTime, n);
+    }
+    kernelResources info = {.workGroupSize = r.workGroupSize,
+                            .preferredMultiple = r.preferredMultiple,
+                            .localMem = r.localMem,
+                            .privateMem = r.privateMem,
+                            .compiled = {r.compiled[0], r.compiled[1]}};
+    printKernelInfo(names[k], &info, r.local[0] ? r.local : NULL);
+  }
+}
+
+// one row of the bench table, also written to out if it is open. rates are
+// at the median time, counting 2n^3 flops and A, B & C each moved once.
+void benchRow(benchWriter *out, benchRecord *r, const char *check) {
+  int n = r->n;
+  const benchStats *s = &r->stats;
+  r->gflops = 2.0 * n * n * (double)n / s->median * 1e-9;
+  r->gbps = 3.0 * n * n * sizeof(double) / s->median * 1e-9;
+  printf("%6d %-6s %5d %10.3f %10.3f %10.3f %9.3f %10.2f %8.2f %10.3f %6s\n",
+         n, r->kernel, s->count, s->min * 1e3, s->median * 1e3, s->p95 * 1e3,
+         s->stddev * 1e3, r->gflops, r->gbps, r->call * 1e3, check);
+  benchWrite(out, r);
+}
+
+// matrixOp bench: every kernel (or only one) & the CPU path over a list of
+// sizes, with warm-up runs dropped and the timed repetitions summarized.
+// device samples are kernel time from the profiling events, "call" the
+// median wall time of the whole clmmGemm with its copies. the CPU result,
+// where it is timed, checks the kernels at the same size. with an outPath
+// every row is also saved as a record, CSV if it ends in .csv, else JSON.
+int runBench(const char *sizeList, int warmup, int reps, int cpuMax,
+             char *only, const char *outPath) {
+  char *kernels[] = {"mult", "mult2"};
+  int numKernels = only ? 1 : 2;
+  int sizes[MAX_BENCH_SIZES];
+  int numSizes = parseList(sizeList, sizes, MAX_BENCH_SIZES);
+  if (numSizes < 1) {
+    return 1;
+  }
+  if (reps < 1 || warmup < 0) {
+    fprintf(stderr, "need at least one repetition\n");
+    return 1;
+  }
+
+  clmmContext *ctx = NULL;
+  cl_int err = clmmInit(&ctx, NULL);
+  if (err) {
+    fprintf(stderr, "no device (%s), timing the CPU only\n",
+            clmmErrorString(err));
+  }
+  benchWriter out = {NULL, 0};
+  if (outPath && benchOpen(&out, outPath)) {
+    clmmShutdown(ctx);
+    return 1;
+  }
+  benchRecord host = {
+      .device = "host", .driver = "-", .kernel = "cpu", .warmup = warmup};
+  benchRecord device = {.warmup = warmup};
+  if (ctx) {
+    clmmDeviceInfo(ctx, device.device, BENCH_FIELD, device.driver,
+                   BENCH_FIELD);
+  }
+  double *samples = (double *)malloc(reps * sizeof(double));
+  double *calls = (double *)malloc(reps * sizeof(double));
+  benchStats callStats;
+  int failed = 0;
+
+  if (ctx) {
+    kernelReport(ctx, only ? &only : kernels, numKernels, sizes[numSizes - 1]);
+  }
+  printf("%d warm-up runs, %d timed\n", warmup, reps);
+  printf("%6s %-6s %5s %10s %10s %10s %9s %10s %8s %10s %6s\n", "n",
+         "kernel", "reps", "min ms", "median ms", "p95 ms", "stddev", "GFLOP/s",
+         "GB/s", "call ms", "check");
+  for (int s = 0; s < numSizes; s++) {
+    int n = sizes[s];
+    size_t bytes = (size_t)n * n * sizeof(double);
+    double *hA = (double *)hostAlloc(bytes);
+    double *hB = (double *)hostAlloc(bytes);
+    double *hC = (double *)hostAlloc(bytes);
+    double *hRef = (double *)hostAlloc(bytes);
+    int haveRef = n <= cpuMax;
+    if (!hA || !hB || !hC || !hRef) {
+      fprintf(stderr, "not enough host memory for %dx%d, skipped\n", n, n);
+      failed = 1;
+      hostFree(hA);
+      hostFree(hB);
+      hostFree(hC);
+      hostFree(hRef);
+      continue;
+    }
+    initHost(hA, hB, n);
+
+    // counters cover the timed runs only
+    hwCounters counters;
+    for (int r = -warmup; haveRef && r < reps; r++) {
+      if (r == 0) {
+        countersStart(&counters);
+      }
+      double start = wallTime();
+      matrixMultiply(hA, hB, hRef, n);
+      if (r >= 0) {
+        samples[r] = wallTime() - start;
+      }
+    }
+    if (haveRef) {
+      countersStop(&counters);
+      host.n = n;
+      benchSummarize(samples, reps, &host.stats);
+      host.call = host.stats.median;
+      benchRow(&out, &host, "-");
+      countersReport(&counters, "       cpu", 2.0 * n * n * (double)n * reps);
+    }
+
+    for (int k = 0; k < numKernels && ctx; k++) {
+      char *name = only ? only : kernels[k];
+      if ((err = clmmSetKernel(ctx, name))) {
+        failed = 1;
+        break;
+      }
+      for (int r = -warmup; r < reps && !err; r++) {
+        double start = wallTime();
+        err = clmmGemm(ctx, n, hA, hB, hC);
+        if (r >= 0) {
+          calls[r] = wallTime() - start;
+          samples[r] = clmmLastKernelTime(ctx) * 1e-3;
+        }
+      }
+      if (err) {
+        // mult2 cannot run sizes that are not whole tiles
+        printf("%6d %-6s %s\n", n, name, clmmErrorString(err));
+        failed |= err != CL_INVALID_WORK_GROUP_SIZE;
+        continue;
+      }
+      int agrees = !haveRef || checkEq(hC, hRef, n);
+      failed |= !agrees;
+      device.n = n;
+      snprintf(device.kernel, BENCH_FIELD, "%s", name);
+      benchSummarize(samples, reps, &device.stats);
+      benchSummarize(calls, reps, &callStats);
+      device.call = callStats.median;
+      benchRow(&out, &device, !haveRef ? "-" : agrees ? "ok" : "FAIL");
+    }
+    hostFree(hA);
+    hostFree(hB);
+    hostFree(hC);
+    hostFree(hRef);
+  }
+  clmmShutdown(ctx);
+  benchClose(&out);
+  free(samples);
+  free(calls);
+  return failed;
+}
+
+//-----------------sweep-----------------
+typedef struct {
+  char kernel[16]; // cpu, mult or mult2
+  int threads;     // host threads, 0 on the device
+  int n;
+  double seconds;           // median, 0 where the kernel can't run n
+  double gflops, efficiency; // efficiency against the fewest threads
+  int marks;
+} sweepPoint;
+
+enum {
+  MARK_PLATEAU = 1, // first n within SWEEP_PEAK of the curve's best
+  MARK_DROP = 2,    // first n below SWEEP_DROP of the best at smaller n
+  MARK_SCALING = 4, // first thread count under SWEEP_EFFICIENCY
+  MARK_L2 = 8,      // first n whose A, B & C no longer fit in L2
+  MARK_LLC = 16,    // ... in the last level cache
+  SWEEP_MARKS = 5
+};
+
+static const char *markNames[SWEEP_MARKS] = {"plateau", "drop", "scaling",
+                                             "past L2", "past LLC"};
+
+static size_t workingSet(int n) { return 3 * (size_t)n * n * sizeof(double); }
+
+// bytes of one cache level from glibc, 0 where it can't say
+static size_t cacheBytes(int level) {
+  long bytes = -1;
+#if defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+  bytes = sysconf(level == 2 ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE);
+#endif
+  (void)level;
+  return bytes > 0 ? (size_t)bytes : 0;
+}
+
+// knees of one GFLOP/s vs n curve: where it levels off, where it falls
+// away, and for the CPU where the working set outgrows each cache
+static void markCurve(sweepPoint *p, int count, size_t l2, size_t llc) {
+  double top = 0.0, best = 0.0;
+  int plateau = 0, drop = 0;
+  size_t previous = 0;
+  for (int i = 0; i < count; i++) {
+    top = fmax(top, p[i].gflops);
+  }
+  for (int i = 0; i < count; i++) {
+    if (p[i].seconds <= 0.0) {
+      continue;
+    }
+    if (!plateau && p[i].gflops >= SWEEP_PEAK * top) {
+      p[i].marks |= MARK_PLATEAU;
+      plateau = 1;
+    }
+    if (!drop && p[i].gflops < SWEEP_DROP * best) {
+      p[i].marks |= MARK_DROP;
+      drop = 1;
+    }
+    best = fmax(best, p[i].gflops);
+    size_t set = workingSet(p[i].n);
+    if (p[i].threads > 0 && l2 && set > l2 && previous <= l2) {
+      p[i].marks |= MARK_L2;
+    }
+    if (p[i].threads > 0 && llc && set > llc && previous <= llc) {
+      p[i].marks |= MARK_LLC;
+    }
+    previous = set;
+  }
+}
+
+static void printMarks(FILE *file, int marks, int json) {
+  int first = 1;
+  for (int m = 0; m < SWEEP_MARKS; m++) {
+    if (marks & 1 << m) {
+      fprintf(file, json ? "%s\"%s\"" : "%s%s", first ? "" : ", ",
+              markNames[m]);
+      first = 0;
+    }
+  }
+}
+
+// GFLOP/s against n for every kernel, and for the naive CPU multiply at each
+// thread count up to cpuMax, with the knees of each curve marked. device
+// times are kernel time through libclmatmul, the CPU wall time; both are
+// the median of reps after SWEEP_WARMUP untimed runs. the curves go to
+// outPath as one JSON document when it is given.
+int runSweep(const char *sizeList, const char *threadList, int reps,
+             int cpuMax, char *only, const char *outPath) {
+  char *kernels[] = {"mult", "mult2"};
+  int numKernels = only ? 1 : 2;
+  int sizes[MAX_BENCH_SIZES], threads[MAX_SWEEP_THREADS];
+  int numSizes = parseList(sizeList, sizes, MAX_BENCH_SIZES);
+  int numThreads = 0;
+  if (threadList) {
+    numThreads = parseList(threadList, threads, MAX_SWEEP_THREADS);
+  } else {
+    // powers of two up to every online processor, then all of them
+    int online = defaultThreads();
+    for (int t = 1; t < online && numThreads < MAX_SWEEP_THREADS - 1; t *= 2) {
+      threads[numThreads++] = t;
+    }
+    threads[numThreads++] = online;
+  }
+  if (numSizes < 1 || numThreads < 1) {
+    return 1;
+  }
+  if (reps < 1) {
+    fprintf(stderr, "need at least one repetition\n");
+    return 1;
+  }
+
+  clmmContext *ctx = NULL;
+  cl_int err = clmmInit(&ctx, NULL);
+  if (err) {
+    fprintf(stderr, "no device (%s), sweeping the CPU only\n",
+            clmmErrorString(err));
+  }
+  char device[BENCH_FIELD] = "-", driver[BENCH_FIELD] = "-";
+  if (ctx) {
+    clmmDeviceInfo(ctx, device, BENCH_FIELD, driver, BENCH_FIELD);
+  }
+  // one curve per thread count, then one per kernel, each numSizes long
+  int numCurves = numThreads + numKernels;
+  sweepPoint *points =
+      (sweepPoint *)calloc((size_t)numCurves * numSizes, sizeof(sweepPoint));
+  double *samples = (double *)malloc(reps * sizeof(double));
+  if (!points || !samples) {
+    clmmShutdown(ctx);
+    free(points);
+    free(samples);
+    return 1;
+  }
+  int failed = 0;
+  if (ctx) {
+    kernelReport(ctx, only ? &only : kernels, numKernels, sizes[numSizes - 1]);
+  }
+
+  for (int s = 0; s < numSizes; s++) {
+    int n = sizes[s];
+    size_t bytes = (size_t)n * n * sizeof(double);
+    double *hA = (double *)hostAlloc(bytes);
+    double *hB = (double *)hostAlloc(bytes);
+    double *hC = (double *)hostAlloc(bytes);
+    if (!hA || !hB || !hC) {
+      // its points stay empty & are left out of the table
+      fprintf(stderr, "not enough host memory for %dx%d, skipped\n", n, n);
+      failed = 1;
+      hostFree(hA);
+      hostFree(hB);
+      hostFree(hC);
+      continue;
+    }
+    initHost(hA, hB, n);
+    for (int c = 0; c < numCurves; c++) {
+      sweepPoint *p = &points[c * numSizes + s];
+      p->n = n;
+      if (c < numThreads) {
+        snprintf(p->kernel, sizeof(p->kernel), "cpu");
+        p->threads = threads[c];
+        for (int r = -SWEEP_WARMUP; n <= cpuMax && r < reps; r++) {
+          double start = wallTime();
+          matrixMultiplyThreads(hA, hB, hC, n, p->threads);
+          if (r >= 0) {
+            samples[r] = wallTime() - start;
+          }
+        }
+        if (n > cpuMax) {
+          continue;
+        }
+      } else {
+        char *name = only ? only : kernels[c - numThreads];
+        snprintf(p->kernel, sizeof(p->kernel), "%s", name);
+        if (!ctx || (err = clmmSetKernel(ctx, name))) {
+          failed |= ctx != NULL;
+          continue;
+        }
+        for (int r = -SWEEP_WARMUP; r < reps && !err; r++) {
+          err = clmmGemm(ctx, n, hA, hB, hC);
+          if (r >= 0) {
+            samples[r] = clmmLastKernelTime(ctx) * 1e-3;
+          }
+        }
+        if (err) {
+          // mult2 cannot run sizes that are not whole tiles
+          failed |= err != CL_INVALID_WORK_GROUP_SIZE;
+          continue;
+        }
+      }
+      benchStats stats;
+      benchSummarize(samples, reps, &stats);
+      p->seconds = stats.median;
+      p->gflops = 2.0 * n * n * (double)n / stats.median * 1e-9;
+    }
+    hostFree(hA);
+    hostFree(hB);
+    hostFree(hC);
+  }
+  clmmShutdown(ctx);
+
+  // thread scaling at each n, against the first thread count
+  for (int s = 0; s < numSizes; s++) {
+    const sweepPoint *base = &points[s];
+    int knee = 0;
+    for (int c = 0; c < numThreads && base->seconds > 0.0; c++) {
+      sweepPoint *p = &points[c * numSizes + s];
+      p->efficiency = p->gflops / (base->gflops * p->threads / base->threads);
+      if (!knee && p->efficiency < SWEEP_EFFICIENCY) {
+        p->marks |= MARK_SCALING;
+        knee = 1;
+      }
+    }
+  }
+  size_t l2 = cacheBytes(2), llc = cacheBytes(3);
+  for (int c = 0; c < numCurves; c++) {
+    markCurve(&points[c * numSizes], numSizes, l2, llc);
+  }
+
+  printf("sweep on %s; host L2 %zu KiB, LLC %zu KiB\n", device, l2 >> 10,
+         llc >> 10);
+  printf("%6s %-6s %7s %9s %10s %9s %6s  %s\n", "n", "kernel", "threads",
+         "set MiB", "median ms", "GFLOP/s", "eff", "knees");
+  for (int c = 0; c < numCurves; c++) {
+    for (int s = 0; s < numSizes; s++) {
+      const sweepPoint *p = &points[c * numSizes + s];
+      if (p->seconds <= 0.0) {
+        continue;
+      }
+      printf("%6d %-6s %7d %9.2f %10.3f %9.2f", p->n, p->kernel, p->threads,
+             workingSet(p->n) / 1048576.0, p->seconds * 1e3, p->gflops);
+      if (p->threads > 0) {
+        printf(" %6.2f  ", p->efficiency);
+      } else {
+        printf(" %6s  ", "-");
+      }
+      printMarks(stdout, p->marks, 0);
+      printf("\n");
+    }
+  }
+
+  FILE *out = outPath ? fopen(outPath, "w") : NULL;
+  if (outPath && !out) {
+    fprintf(stderr, "cannot write %s\n", outPath);
+    failed = 1;
+  }
+  if (out) {
+    fprintf(out, "{\"device\": ");
+    benchString(out, device, 0);
+    fprintf(out, ", \"driver\": ");
+    benchString(out, driver, 0);
+    fprintf(out, ", \"l2_bytes\": %zu, \"llc_bytes\": %zu, \"points\": [", l2,
+            llc);
+    int first = 1;
+    for (int i = 0; i < numCurves * numSizes; i++) {
+      const sweepPoint *p = &points[i];
+      if (p->seconds <= 0.0) {
+        continue;
+      }
+      fprintf(out,
+              "%s\n  {\"kernel\": \"%s\", \"threads\": %d, \"n\": %d, "
+              "\"working_set_bytes\": %zu, \"median_ms\": %.6g, "
+              "\"gflops\": %.6g, \"efficiency\": %.4g, \"knees\": [",
+              first ? "" : ",", p->kernel, p->threads, p->n,
+              workingSet(p->n), p->seconds * 1e3, p->gflops, p->efficiency);
+      printMarks(out, p->marks, 1);
+      fprintf(out, "]}");
+      first = 0;
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+  }
+  free(points);
+  free(samples);
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+
+  // inputs come from the CLMM_SEED stream, so runs repeat exactly
+  int failed = 0;
+
+  // --n sets the matrix size, --kernel runs one kernel instead of all,
+  // --no-check skips the CPU verification, --panel <cols> splits C into
+  // column panels to overlap copies & compute, --multi spreads the panels
+  // over every device on the host, --device picks the device otherwise,
+  // --breakdown runs each kernel cold & reports where the time went.
+  // "matrixOp bench" times the kernels & CPU over --sizes <list> instead,
+  // with --warmup <k> untimed & --reps <k> timed runs of each, and the CPU
+  // up to --cpu-max <size>, saving the rows to --out <file.json|file.csv>.
+  // "matrixOp roofline" measures the device's peak FLOP/s & bandwidth and
+  // places mult & mult2 at --n and the vector kernels under them.
+  // "matrixOp sweep" charts GFLOP/s against --sizes for every kernel and
+  // for the CPU at each of --threads <list>, marking the knees, and saves
+  // the curves as JSON to --out
+  int n = N;
+  char *only = NULL;
+  int check = 1;
+  int panelCols = 0;
+  int numQueues = CLMM_MAX_QUEUES;
+  int multi = 0;
+  int breakdown = 0;
+  int bench = argc > 1 && !strcmp(argv[1], "bench");
+  int roofline = argc > 1 && !strcmp(argv[1], "roofline");
+  int sweep = argc > 1 && !strcmp(argv[1], "sweep");
+  const char *sizeList = sweep ? SWEEP_SIZES : BENCH_SIZES;
+  const char *threadList = NULL;
+  int warmup = BENCH_WARMUP;
+  int reps = sweep ? SWEEP_REPS : BENCH_REPS;
+  int cpuMax = BENCH_CPU_MAX;
+  const char *outPath = NULL;
+  for (int i = 1 + bench + roofline + sweep; i < argc; i++) {
+    if (!strcmp(argv[i], "--n") && i + 1 < argc) {
+      n = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--kernel") && i + 1 < argc) {
+      only = argv[++i];
+    } else if (!strcmp(argv[i], "--no-check")) {
+      check = 0;
+    } else if (!strcmp(argv[i], "--panel") && i + 1 < argc) {
+      panelCols = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--queues") && i + 1 < argc) {
+      numQueues = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--multi")) {
+      multi = 1;
+    } else if (!strcmp(argv[i], "--breakdown")) {
+      breakdown = 1;
+    } else if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+      setDeviceSpec(argv[++i]);
+    } else if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+      sizeList = argv[++i];
+    } else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+      warmup = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+      reps = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--cpu-max") && i + 1 < argc) {
+      cpuMax = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threadList = argv[++i];
+    } else if (!strcmp(argv[i], "--list-devices")) {
+      listDevices();
+      return 0;
+    }
+  }
+  if (bench) {
+    return runBench(sizeList, warmup, reps, cpuMax, only, outPath);
+  }
+  if (sweep) {
+    return runSweep(sizeList, threadList, reps, cpuMax, only, outPath);
+  }
+  if (n < 1) {
+    fprintf(stderr, "matrix size must be positive\n");
+    return 1;
+  }
+  if (roofline) {
+    runtime rt;
+    if (runtimeInit(&rt, NULL)) {
+      return 1;
+    }
+    failed = runRoofline(&rt, n) != CL_SUCCESS;
+    runtimeShutdown(&rt);
+    return failed;
+  }
+  size_t bytes = (size_t)n * n * sizeof(double);
 
   // host matrices
-  double *hA = (double *)malloc(bytes);
-  double *hB = (double *)malloc(bytes);
-  double *hC = (double *)malloc(bytes);
+  double *hA = (double *)hostAlloc(bytes);
+  double *hB = (double *)hostAlloc(bytes);
+  double *hC = (double *)hostAlloc(bytes);
+  clmmContext *ctx = NULL;
+  if (!hA || !hB || !hC) {
+    fprintf(stderr, "not enough host memory for %dx%d matrices\n", n, n);
+    hostFree(hA);
+    hostFree(hB);
+    hostFree(hC);
+    return 1;
+  }
 
-  runKernel(hA, hB, hC, "matrix.cl", "mult");
-  runKernel(hA, hB, hC, "matrix.cl", "mult2");
+  if (only) {
+    failed |= multiply(&ctx, hA, hB, hC, n, only, panelCols, numQueues,
+                       multi, breakdown) != 0;
+  } else {
+    failed |= multiply(&ctx, hA, hB, hC, n, "mult", panelCols, numQueues,
+                       multi, breakdown) != 0;
+    failed |= multiply(&ctx, hA, hB, hC, n, "mult2", panelCols, numQueues,
+                       multi, breakdown) != 0;
+  }
+  clmmShutdown(ctx);
 
-  cpuBench(hA, hB, hC);
+  if (check) {
+    cpuBench(hA, hB, hC, n);
+  }
 
-  free(hA);
-  free(hB);
-  free(hC);
-}
\ No newline at end of file
+  hostFree(hA);
+  hostFree(hB);
+  hostFree(hC);
+  return failed;
+}
@@ -0,0 +1,305 @@
+#include "multiDevice.h"
+#include "runtime.h"
+#include "timer.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// one device and everything it needs to multiply a panel of C on its own:
+// its runtime for the context, queue, program & buffers
+typedef struct {
+  runtime rt;
+  char name[128];
+  cl_kernel kernel;
+  kernelResources resources; // sizes its work-groups
+  cl_mem dA, dB, dC;
+  pthread_t thread;
+
+  // results
+  int panels;        // chunks taken
+  int cols;          // columns of C computed
+  double busy;       // seconds spent on chunks
+  double kernelTime; // seconds the kernels ran on the device
+  double rate;       // last measured columns per second
+  cl_int error;      // what stopped the device, if anything
+} worker;
+
+// columns of C handed out on demand, sized by each device's throughput.
+// chunks a device failed on go back in the retry list for the others, so
+// workers wait for those in flight before giving up on more work.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t changed; // a chunk finished or went back to retry
+  int n;
+  int nextCol;
+  int inFlight; // chunks handed out & not yet finished or failed
+  int panelCols;
+  int numWorkers;
+  worker *workers;
+  int numRetries;
+  int *retryFirst, *retryCols;
+  const double *hA, *hB;
+  double *hC;
+} scheduler;
+
+// what each worker thread is started with
+typedef struct {
+  scheduler *sched;
+  worker *self;
+} workerArg;
+
+// hand out the next chunk of columns. a device that has not been measured yet
+// gets one panel; afterwards it gets its share of half of what is left, by
+// measured throughput, so fast devices take big chunks early and the tail is
+// split finely enough for all devices to finish together. once every column
+// is handed out it waits on the chunks still running, which may fail back
+// to the retry list, and returns 0 when there are none.
+static int nextChunk(scheduler *sched, worker *self, int *firstCol) {
+  pthread_mutex_lock(&sched->lock);
+  while (sched->numRetries == 0 && sched->nextCol == sched->n &&
+         sched->inFlight > 0) {
+    pthread_cond_wait(&sched->changed, &sched->lock);
+  }
+  if (sched->numRetries > 0) {
+    sched->numRetries--;
+    *firstCol = sched->retryFirst[sched->numRetries];
+    int cols = sched->retryCols[sched->numRetries];
+    sched->inFlight++;
+    pthread_mutex_unlock(&sched->lock);
+    return cols;
+  }
+  int remaining = sched->n - sched->nextCol;
+  int cols = sched->panelCols;
+  if (self->rate > 0.0) {
+    double total = 0.0;
+    for (int w = 0; w < sched->numWorkers; w++) {
+      total += sched->workers[w].rate;
+    }
+    cols = (int)(remaining * (self->rate / total) / 2.0);
+    cols -= cols % sched->panelCols;
+    if (cols < sched->panelCols) {
+      cols = sched->panelCols;
+    }
+    if (cols > sched->panelCols * MAX_PANEL_GROWTH) {
+      cols = sched->panelCols * MAX_PANEL_GROWTH;
+    }
+  }
+  if (cols > remaining) {
+    cols = remaining;
+  }
+  *firstCol = sched->nextCol;
+  sched->nextCol += cols;
+  sched->inFlight += cols > 0;
+  pthread_mutex_unlock(&sched->lock);
+  return cols;
+}
+
+// multiply one chunk of columns on a device
+static cl_int runChunk(scheduler *sched, worker *self, int firstCol,
+                       int cols) {
+  int n = sched->n;
+  const size_t global[2] = {n, cols};
+  size_t local[2];
+  size_t offset = (size_t)firstCol * n;
+  size_t size = (size_t)cols * n * sizeof(double);
+  cl_event done = NULL, traced;
+  double nanoseconds;
+  cl_int ret;
+
+  ret = clEnqueueWriteBuffer(self->rt.queues[0], self->dB, CL_FALSE, 0, size,
+                             sched->hB + offset, 0, NULL, traceEvent(&traced));
+  traceTake(traced, "upload B chunk");
+  if (checkErr(ret, "queued panel upload") ||
+      (ret = setArgs(&self->kernel, n, self->dA, self->dB, self->dC))) {
+    return ret;
+  }
+  ret = clEnqueueNDRangeKernel(self->rt.queues[0], self->kernel, 2, NULL,
+                               global,
+                               kernelLocal(&self->resources, n, cols, local),
+                               0, NULL, &done);
+  if (checkErr(ret, "queued panel kernel")) {
+    return ret;
+  }
+  traceLaunch(done, self->kernel);
+  ret = clEnqueueReadBuffer(self->rt.queues[0], self->dC, CL_TRUE, 0, size,
+                            sched->hC + offset, 0, NULL, traceEvent(&traced));
+  traceTake(traced, "download C chunk");
+  if (checkErr(ret, "read panel") == CL_SUCCESS) {
+    timeProf(&nanoseconds, done);
+    self->kernelTime += nanoseconds * 1e-9;
+  }
+  clReleaseEvent(done);
+  return ret;
+}
+
+// upload B, multiply & download C one chunk at a time until C is done or the
+// device fails
+static void *workerLoop(void *arg) {
+  scheduler *sched = ((workerArg *)arg)->sched;
+  worker *self = ((workerArg *)arg)->self;
+  int firstCol;
+  int cols;
+
+  while ((cols = nextChunk(sched, self, &firstCol)) > 0) {
+    double start = wallTime();
+    cl_int ret = runChunk(sched, self, firstCol, cols);
+    double seconds = wallTime() - start;
+
+    // the rate is read by the other threads when they size their chunks
+    pthread_mutex_lock(&sched->lock);
+    sched->inFlight--;
+    pthread_cond_broadcast(&sched->changed);
+    if (ret != CL_SUCCESS) {
+      self->error = ret;
+      self->rate = 0.0;
+      sched->retryFirst[sched->numRetries] = firstCol;
+      sched->retryCols[sched->numRetries] = cols;
+      sched->numRetries++;
+      pthread_mutex_unlock(&sched->lock);
+      break;
+    }
+    self->rate = cols / seconds;
+    pthread_mutex_unlock(&sched->lock);
+    self->panels++;
+    self->cols += cols;
+    self->busy += seconds;
+  }
+  return NULL;
+}
+
+static void releaseWorker(worker *w) {
+  if (w->kernel) {
+    clReleaseKernel(w->kernel);
+  }
+  runtimeRecycle(&w->rt, w->dA);
+  runtimeRecycle(&w->rt, w->dB);
+  runtimeRecycle(&w->rt, w->dC);
+  runtimeShutdown(&w->rt);
+}
+
+// every platform's devices share the columns of C. each device keeps a full
+// copy of A and multiplies the column panels of B it takes, so the panels of C
+// land straight in their place in hC. every device gets a runtime for the
+// call, so its program is loaded from the binary cache after the first run.
+// a device that fails to set up is left out, and one that fails mid-run
+// hands its chunk to the others; the call only fails if no device is left.
+cl_int runKernelMultiDevice(const double *hA, const double *hB, double *hC,
+                            int n, char *filename, char *func,
+                            int panelCols) {
+  size_t bytes = (size_t)n * n * sizeof(double);
+  cl_int ret = CL_DEVICE_NOT_FOUND;
+
+  // panels hold whole 16x16 tiles so mult2 can run on them unchanged
+  panelCols -= panelCols % 16;
+  if (panelCols < 16) {
+    panelCols = 16;
+  }
+  if (panelCols > n) {
+    panelCols = n;
+  }
+  int maxCols = panelCols * MAX_PANEL_GROWTH < n
+                    ? panelCols * MAX_PANEL_GROWTH
+                    : n;
+  size_t chunkBytes = (size_t)n * maxCols * sizeof(double);
+
+  cl_platform_id *platforms;
+  cl_device_id *devices;
+  cl_uint numDevices = getAllDevices(&platforms, &devices);
+  worker *workers = (worker *)calloc(numDevices, sizeof(worker));
+  int numWorkers = 0;
+
+  for (cl_uint d = 0; d < numDevices; d++) {
+    worker *w = &workers[numWorkers];
+    cl_device_fp_config fp64 = 0;
+    clGetDeviceInfo(devices[d], CL_DEVICE_NAME, sizeof(w->name), w->name,
+                    NULL);
+    clGetDeviceInfo(devices[d], CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64),
+                    &fp64, NULL);
+    if (!fp64) {
+      printf("skipping %s: no double precision\n", w->name);
+      continue;
+    }
+
+    if (runtimeInitDevice(&w->rt, platforms[d], devices[d]) ||
+        runtimeKernel(&w->rt, filename, func, &w->kernel) ||
+        kernelInfo(w->kernel, w->rt.deviceID, &w->resources) ||
+        runtimeBuffer(&w->rt, bytes, CL_MEM_READ_ONLY, &w->dA) ||
+        runtimeBuffer(&w->rt, chunkBytes, CL_MEM_READ_ONLY, &w->dB) ||
+        runtimeBuffer(&w->rt, chunkBytes, CL_MEM_WRITE_ONLY, &w->dC) ||
+        writeBuffer(w->dA, hA, bytes, &w->rt.queues[0])) {
+      printf("skipping %s: setup failed\n", w->name);
+      releaseWorker(w);
+      *w = (worker){0};
+      continue;
+    }
+    numWorkers++;
+  }
+
+  scheduler sched;
+  pthread_mutex_init(&sched.lock, NULL);
+  pthread_cond_init(&sched.changed, NULL);
+  sched.n = n;
+  sched.nextCol = 0;
+  sched.inFlight = 0;
+  sched.panelCols = panelCols;
+  sched.numWorkers = numWorkers;
+  sched.workers = workers;
+  sched.numRetries = 0;
+  sched.retryFirst = (int *)malloc((numWorkers + 1) * sizeof(int));
+  sched.retryCols = (int *)malloc((numWorkers + 1) * sizeof(int));
+  sched.hA = hA;
+  sched.hB = hB;
+  sched.hC = hC;
+
+  workerArg *args = (workerArg *)malloc((numWorkers + 1) * sizeof(workerArg));
+  double start = wallTime();
+  for (int w = 0; w < numWorkers; w++) {
+    args[w].sched = &sched;
+    args[w].self = &workers[w];
+    pthread_create(&workers[w].thread, NULL, workerLoop, &args[w]);
+  }
+  for (int w = 0; w < numWorkers; w++) {
+    pthread_join(workers[w].thread, NULL);
+  }
+  double wall = wallTime() - start;
+
+  // C is complete when every column was handed out and nothing is left to
+  // retry
+  if (numWorkers > 0 && sched.nextCol == n && sched.numRetries == 0) {
+    ret = CL_SUCCESS;
+    printf("kernel %s:%s on %d devices in %f milliseconds\n", filename, func,
+           numWorkers, wall * 1000.0);
+  } else {
+    fprintf(stderr, "kernel %s:%s: no device left to finish C\n", filename,
+            func);
+    for (int w = 0; w < numWorkers; w++) {
+      ret = workers[w].error ? workers[w].error : ret;
+    }
+  }
+
+  if (numWorkers > 0) {
+    printf("device                          chunks columns  busy%%  kernel%%  "
+           "GFLOP/s\n");
+  }
+  for (int w = 0; w < numWorkers; w++) {
+    worker *self = &workers[w];
+    double flops = 2.0 * n * n * (double)self->cols;
+    printf("%-32.32s %5d %7d %6.1f %7.1f %8.2f%s\n", self->name, self->panels,
+           self->cols, 100.0 * self->busy / wall,
+           100.0 * self->kernelTime / wall,
+           self->busy > 0.0 ? flops / self->busy * 1e-9 : 0.0,
+           self->error ? " (failed)" : "");
+    releaseWorker(self);
+  }
+
+  pthread_mutex_destroy(&sched.lock);
+  pthread_cond_destroy(&sched.changed);
+  free(sched.retryFirst);
+  free(sched.retryCols);
+  free(args);
+  free(workers);
+  free(platforms);
+  free(devices);
+  return ret;
+}
@@ -0,0 +1,14 @@
+// split a matrix multiplication across every OpenCL device on the host
+
+#ifndef MULTIDEVICE_H_
+#define MULTIDEVICE_H_
+
+#include "clHelper.h"
+
+#define MAX_PANEL_GROWTH 8 // largest chunk a device takes, in panels
+
+cl_int runKernelMultiDevice(const double *hA, const double *hB, double *hC,
+                            int n, char *filename, char *func,
+                            int panelCols);
+
+#endif
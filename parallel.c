@@ -0,0 +1,68 @@
+#include "parallel.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  pthread_t thread;
+  size_t begin, end;
+  int index;
+  rangeFn fn;
+  void *arg;
+} slice;
+
+// CLMM_THREADS if set, otherwise every online processor
+int defaultThreads(void) {
+  const char *env = getenv(THREADS_ENV);
+  if (env && atoi(env) > 0) {
+    return atoi(env);
+  }
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  return online > 0 ? (int)online : 1;
+}
+
+static void *runSlice(void *arg) {
+  slice *s = (slice *)arg;
+  s->fn(s->begin, s->end, s->index, s->arg);
+  return NULL;
+}
+
+// equal contiguous slices, the calling thread taking the first. a thread
+// that cannot be started has its slice run inline instead.
+void parallelFor(size_t n, int threads, rangeFn fn, void *arg) {
+  if (threads < 1) {
+    threads = 1;
+  }
+  if ((size_t)threads > n) {
+    threads = n > 0 ? (int)n : 1;
+  }
+  slice *slices = (slice *)calloc(threads, sizeof(slice));
+  int *started = (int *)calloc(threads, sizeof(int));
+  if (!slices || !started) {
+    free(slices);
+    free(started);
+    fn(0, n, 0, arg);
+    return;
+  }
+  for (int t = 0; t < threads; t++) {
+    slices[t].begin = n * t / threads;
+    slices[t].end = n * (t + 1) / threads;
+    slices[t].index = t;
+    slices[t].fn = fn;
+    slices[t].arg = arg;
+  }
+  for (int t = 1; t < threads; t++) {
+    started[t] =
+        !pthread_create(&slices[t].thread, NULL, runSlice, &slices[t]);
+  }
+  runSlice(&slices[0]);
+  for (int t = 1; t < threads; t++) {
+    if (started[t]) {
+      pthread_join(slices[t].thread, NULL);
+    } else {
+      runSlice(&slices[t]);
+    }
+  }
+  free(slices);
+  free(started);
+}
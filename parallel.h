@@ -0,0 +1,16 @@
+// split a loop over [0, n) across host threads
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+
+#define THREADS_ENV "CLMM_THREADS" // overrides the host thread count
+
+// called once per thread with its contiguous slice of the range
+typedef void (*rangeFn)(size_t begin, size_t end, int thread, void *arg);
+
+int defaultThreads(void);
+void parallelFor(size_t n, int threads, rangeFn fn, void *arg);
+
+#endif
@@ -0,0 +1,112 @@
+#include "philox.h"
+#include "parallel.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// constants from Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+typedef struct {
+  double *out;
+  double min, max;
+  unsigned long long seed;
+  unsigned stream;
+} fillJob;
+
+// CLMM_SEED if set, so runs can be repeated exactly
+unsigned long long defaultSeed(void) {
+  const char *env = getenv(SEED_ENV);
+  return env ? strtoull(env, NULL, 0) : PHILOX_DEFAULT_SEED;
+}
+
+static void philox(uint32_t ctr[4], unsigned long long seed) {
+  uint32_t key0 = (uint32_t)seed, key1 = (uint32_t)(seed >> 32);
+  for (int r = 0; r < PHILOX_ROUNDS; r++) {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * ctr[0];
+    uint64_t p1 = (uint64_t)PHILOX_M1 * ctr[2];
+    uint32_t c0 = (uint32_t)(p1 >> 32) ^ ctr[1] ^ key0;
+    uint32_t c2 = (uint32_t)(p0 >> 32) ^ ctr[3] ^ key1;
+    ctr[0] = c0;
+    ctr[1] = (uint32_t)p1;
+    ctr[2] = c2;
+    ctr[3] = (uint32_t)p0;
+    key0 += PHILOX_W0;
+    key1 += PHILOX_W1;
+  }
+}
+
+// one block of four words gives elements 2k & 2k+1, 53 bits each. kept as
+// a separate multiply & add so it rounds like philox.cl, which turns off
+// contraction into fma.
+static inline double toUniform(const uint32_t *words, double min, double max) {
+  uint64_t bits = ((uint64_t)words[0] << 32 | words[1]) >> 11;
+  double scaled = (max - min) * (bits * 0x1.0p-53);
+  return min + scaled;
+}
+
+double philoxUniform(unsigned long long seed, unsigned stream, size_t i,
+                     double min, double max) {
+  uint64_t block = i / 2;
+  uint32_t ctr[4] = {(uint32_t)block, (uint32_t)(block >> 32), stream, 0};
+  philox(ctr, seed);
+  return toUniform(ctr + 2 * (i % 2), min, max);
+}
+
+static void fillRange(size_t begin, size_t end, int thread, void *arg) {
+  fillJob *job = (fillJob *)arg;
+  (void)thread;
+  size_t i = begin;
+  if (i % 2 && i < end) {
+    job->out[i] = philoxUniform(job->seed, job->stream, i, job->min, job->max);
+    i++;
+  }
+  for (; i < end; i += 2) {
+    uint64_t block = i / 2;
+    uint32_t ctr[4] = {(uint32_t)block, (uint32_t)(block >> 32), job->stream,
+                       0};
+    philox(ctr, job->seed);
+    job->out[i] = toUniform(ctr, job->min, job->max);
+    if (i + 1 < end) {
+      job->out[i + 1] = toUniform(ctr + 2, job->min, job->max);
+    }
+  }
+}
+
+// n uniform doubles in [min, max) across the host threads. different streams
+// of one seed are independent, e.g. one per input array.
+void randomFill(double *out, size_t n, double min, double max,
+                unsigned long long seed, unsigned stream, int threads) {
+  fillJob job = {out, min, max, seed, stream};
+  parallelFor(n, threads, fillRange, &job);
+}
+
+// the same values as randomFill, generated in device memory by the
+// philox_uniform kernel of a program built from philox.cl
+cl_int randomFillDevice(cl_command_queue commandQueue, cl_program program,
+                        cl_mem out, size_t n, double min, double max,
+                        unsigned long long seed, unsigned stream,
+                        cl_event *event) {
+  cl_ulong length = n, key = seed;
+  cl_uint id = stream;
+  size_t global = (n + 1) / 2;
+  cl_int err;
+  cl_kernel kernel = clCreateKernel(program, PHILOX_KERNEL, &err);
+  if (err) {
+    return err;
+  }
+  if (!(err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &out)) &&
+      !(err = clSetKernelArg(kernel, 1, sizeof(length), &length)) &&
+      !(err = clSetKernelArg(kernel, 2, sizeof(key), &key)) &&
+      !(err = clSetKernelArg(kernel, 3, sizeof(id), &id)) &&
+      !(err = clSetKernelArg(kernel, 4, sizeof(min), &min)) &&
+      !(err = clSetKernelArg(kernel, 5, sizeof(max), &max))) {
+    err = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &global, NULL,
+                                 0, NULL, event);
+  }
+  clReleaseKernel(kernel);
+  return err;
+}
@@ -0,0 +1,37 @@
+//Philox4x32-10 uniform doubles, the same values randomFill makes on the host
+//each work-item turns one counter block into elements 2k & 2k+1
+
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+//an fma would round differently from the host's multiply & add
+#pragma OPENCL FP_CONTRACT OFF
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+double toUniform(uint hi, uint lo, double min, double max){
+	ulong bits = (((ulong)hi << 32) | lo) >> 11;
+	double scaled = (max - min) * (bits * 0x1.0p-53);
+	return min + scaled;
+}
+
+__kernel void philox_uniform(__global double *out, const ulong n, const ulong seed, const uint stream, const double min, const double max){
+	ulong block = get_global_id(0);
+	uint4 ctr = (uint4)((uint)block, (uint)(block >> 32), stream, 0);
+	uint2 key = (uint2)((uint)seed, (uint)(seed >> 32));
+	for (int r = 0; r < PHILOX_ROUNDS; r++){
+		uint lo0 = PHILOX_M0 * ctr.x, hi0 = mul_hi(PHILOX_M0, ctr.x);
+		uint lo1 = PHILOX_M1 * ctr.z, hi1 = mul_hi(PHILOX_M1, ctr.z);
+		ctr = (uint4)(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+		key += (uint2)(PHILOX_W0, PHILOX_W1);
+	}
+	ulong i = 2 * block;
+	if (i < n){
+		out[i] = toUniform(ctr.x, ctr.y, min, max);
+	}
+	if (i + 1 < n){
+		out[i + 1] = toUniform(ctr.z, ctr.w, min, max);
+	}
+}
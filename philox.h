@@ -0,0 +1,25 @@
+// Philox4x32-10 counter-based random numbers, on the host threads or on the
+// device with philox.cl. element i of a stream depends only on the seed, the
+// stream & i, so the values are the same whoever generates them.
+
+#ifndef PHILOX_H_
+#define PHILOX_H_
+
+#include <CL/opencl.h>
+#include <stddef.h>
+
+#define SEED_ENV "CLMM_SEED"          // seed for every generated input
+#define PHILOX_DEFAULT_SEED 20240229u // seed when CLMM_SEED is not set
+#define PHILOX_KERNEL "philox_uniform"
+
+unsigned long long defaultSeed(void);
+double philoxUniform(unsigned long long seed, unsigned stream, size_t i,
+                     double min, double max);
+void randomFill(double *out, size_t n, double min, double max,
+                unsigned long long seed, unsigned stream, int threads);
+cl_int randomFillDevice(cl_command_queue commandQueue, cl_program program,
+                        cl_mem out, size_t n, double min, double max,
+                        unsigned long long seed, unsigned stream,
+                        cl_event *event);
+
+#endif
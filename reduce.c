@@ -0,0 +1,151 @@
+#include "reduce.h"
+#include "trace.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// stage 1 kernels by precision & op
+static const char *kernelNames[2][4] = {
+    {"sum_d", "dot_d", "sumsq_d", "amax_d"},
+    {"sum_f", "dot_f", "sumsq_f", "amax_f"}};
+
+const char *reduceName(reduceOp op) {
+  static const char *names[4] = {"sum", "dot", "nrm2", "amax"};
+  return names[op];
+}
+
+// largest power of two work-group the kernel allows, up to REDUCE_LOCAL
+static size_t localSize(cl_kernel kernel, cl_device_id device) {
+  size_t max = REDUCE_LOCAL;
+  size_t local = 1;
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                           sizeof(max), &max, NULL);
+  while (local * 2 <= max && local * 2 <= REDUCE_LOCAL) {
+    local *= 2;
+  }
+  return local;
+}
+
+static cl_int launch(cl_command_queue commandQueue, cl_kernel kernel,
+                     cl_ulong n, cl_mem x, cl_mem y, cl_mem out, size_t groups,
+                     size_t local, size_t elementSize, cl_event *event) {
+  size_t global = groups * local;
+  cl_int err;
+  if ((err = clSetKernelArg(kernel, 0, sizeof(n), &n)) ||
+      (err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &x)) ||
+      (err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &y)) ||
+      (err = clSetKernelArg(kernel, 3, sizeof(cl_mem), &out)) ||
+      (err = clSetKernelArg(kernel, 4, local * elementSize, NULL))) {
+    return err;
+  }
+  return clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &global, &local,
+                                0, NULL, event);
+}
+
+// every stage 1 kernel of one precision from the runtime's reduce.cl
+cl_int reduceKernelsCreate(runtime *rt, int isFloat, reduceKernels *k) {
+  cl_int err = CL_SUCCESS;
+  memset(k, 0, sizeof(*k));
+  k->isFloat = isFloat;
+  k->units = 1;
+  clGetDeviceInfo(rt->deviceID, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(k->units),
+                  &k->units, NULL);
+  for (int op = 0; op < 4 && !err; op++) {
+    err = runtimeKernel(rt, "reduce.cl", kernelNames[isFloat][op],
+                        &k->kernels[op]);
+    if (!err) {
+      k->local[op] = localSize(k->kernels[op], rt->deviceID);
+    }
+  }
+  if (err) {
+    reduceKernelsRelease(k);
+  }
+  return err;
+}
+
+void reduceKernelsRelease(reduceKernels *k) {
+  for (int op = 0; op < 4; op++) {
+    if (k->kernels[op]) {
+      clReleaseKernel(k->kernels[op]);
+      k->kernels[op] = NULL;
+    }
+  }
+}
+
+// op over n elements of x (and y for dot) on the device. stage 1 leaves one
+// partial per work-group, a few groups per compute unit; stage 2 folds those
+// in one work-group, summing for everything but amax. the square root of
+// nrm2 is taken on the host. *nanoseconds gets the device time of both. the
+// partials come from the runtime's pool & go back to it.
+cl_int reduceVector(runtime *rt, cl_command_queue commandQueue,
+                    const reduceKernels *k, reduceOp op, cl_mem x, cl_mem y,
+                    size_t n, double *result, double *nanoseconds) {
+  size_t elementSize = k->isFloat ? sizeof(float) : sizeof(double);
+  reduceOp foldOp = op == REDUCE_AMAX ? REDUCE_AMAX : REDUCE_SUM;
+  cl_kernel kernel = k->kernels[op], fold = k->kernels[foldOp];
+  cl_mem partial = NULL, total = NULL;
+  cl_event stages[2] = {NULL, NULL};
+  cl_int err;
+
+  // never more groups than it takes to give every work-item an element
+  size_t local = k->local[op];
+  size_t groups = k->units * REDUCE_GROUPS_PER_CU;
+  if (groups > (n + local - 1) / local) {
+    groups = (n + local - 1) / local;
+  }
+  if (groups < 1) {
+    groups = 1;
+  }
+  if ((err = runtimeBuffer(rt, groups * elementSize, CL_MEM_READ_WRITE,
+                           &partial)) ||
+      (err = runtimeBuffer(rt, elementSize, CL_MEM_READ_WRITE, &total))) {
+    goto cleanup;
+  }
+
+  if ((err = launch(commandQueue, kernel, n, x, y ? y : x, partial, groups,
+                    local, elementSize, &stages[0])) ||
+      (err = launch(commandQueue, fold, groups, partial, partial, total, 1,
+                    k->local[foldOp], elementSize, &stages[1]))) {
+    goto cleanup;
+  }
+  traceLaunch(stages[0], kernel);
+  traceLaunch(stages[1], fold);
+
+  double value;
+  cl_event traced;
+  if (k->isFloat) {
+    float single;
+    err = clEnqueueReadBuffer(commandQueue, total, CL_TRUE, 0, sizeof(single),
+                              &single, 0, NULL, traceEvent(&traced));
+    value = single;
+  } else {
+    err = clEnqueueReadBuffer(commandQueue, total, CL_TRUE, 0, sizeof(value),
+                              &value, 0, NULL, traceEvent(&traced));
+  }
+  if (err) {
+    goto cleanup;
+  }
+  traceTake(traced, "read result");
+  *result = op == REDUCE_NRM2 ? sqrt(value) : value;
+
+  *nanoseconds = 0.0;
+  for (int s = 0; s < 2; s++) {
+    cl_ulong start, end;
+    clGetEventProfilingInfo(stages[s], CL_PROFILING_COMMAND_START,
+                            sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(stages[s], CL_PROFILING_COMMAND_END, sizeof(end),
+                            &end, NULL);
+    *nanoseconds += end - start;
+  }
+
+cleanup:
+  for (int s = 0; s < 2; s++) {
+    if (stages[s]) {
+      clReleaseEvent(stages[s]);
+    }
+  }
+  // done with after the blocking read, else queued ahead of their next user
+  runtimeRecycle(rt, partial);
+  runtimeRecycle(rt, total);
+  return err;
+}
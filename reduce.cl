@@ -0,0 +1,48 @@
+//Two-stage reductions: sum, dot, sum of squares & largest magnitude
+//Each work-group folds a grid-stride slice of the input into one partial in
+//local memory; the host then runs the same kernel as one work-group over the
+//partials. Local sizes must be powers of two.
+
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+#define ADD(a, b) ((a) + (b))
+#define MAX(a, b) fmax((a), (b))
+
+#define VALUE(i) x[i]
+#define PRODUCT(i) (x[i] * y[i])
+#define SQUARE(i) (x[i] * x[i])
+#define MAGNITUDE(i) fabs(x[i])
+
+//y is only read by dot; the host passes x again for the others
+#define REDUCE(NAME, T, MAP, COMBINE) \
+__kernel void NAME(const ulong n, __global const T *x, __global const T *y, \
+		__global T *partial, __local T *scratch){ \
+	const size_t lid = get_local_id(0); \
+	/*grid-stride: each work-item folds every global-size'th element*/ \
+	T acc = 0; \
+	for (size_t i = get_global_id(0); i < n; i += get_global_size(0)){ \
+		acc = COMBINE(acc, MAP(i)); \
+	} \
+	/*tree fold in local memory*/ \
+	scratch[lid] = acc; \
+	barrier(CLK_LOCAL_MEM_FENCE); \
+	for (size_t s = get_local_size(0) / 2; s > 0; s >>= 1){ \
+		if (lid < s){ \
+			scratch[lid] = COMBINE(scratch[lid], scratch[lid + s]); \
+		} \
+		barrier(CLK_LOCAL_MEM_FENCE); \
+	} \
+	if (lid == 0){ \
+		partial[get_group_id(0)] = scratch[0]; \
+	} \
+}
+
+REDUCE(sum_d, double, VALUE, ADD)
+REDUCE(dot_d, double, PRODUCT, ADD)
+REDUCE(sumsq_d, double, SQUARE, ADD)
+REDUCE(amax_d, double, MAGNITUDE, MAX)
+
+REDUCE(sum_f, float, VALUE, ADD)
+REDUCE(dot_f, float, PRODUCT, ADD)
+REDUCE(sumsq_f, float, SQUARE, ADD)
+REDUCE(amax_f, float, MAGNITUDE, MAX)
@@ -0,0 +1,30 @@
+// two-stage device reductions over vectors, kernels in reduce.cl
+
+#ifndef REDUCE_H_
+#define REDUCE_H_
+
+#include "runtime.h"
+
+#define REDUCE_LOCAL 256       // largest work-group used, a power of two
+#define REDUCE_GROUPS_PER_CU 4 // work-groups per compute unit in stage 1
+
+typedef enum { REDUCE_SUM, REDUCE_DOT, REDUCE_NRM2, REDUCE_AMAX } reduceOp;
+
+// the kernels of one precision, made once & reused by every reduction
+typedef struct {
+  int isFloat;
+  cl_kernel kernels[4]; // stage 1 by op; sum & amax also fold the partials
+  size_t local[4];      // work-group of each
+  cl_uint units;        // compute units, for the stage 1 grid
+} reduceKernels;
+
+const char *reduceName(reduceOp op);
+
+cl_int reduceKernelsCreate(runtime *rt, int isFloat, reduceKernels *k);
+void reduceKernelsRelease(reduceKernels *k);
+
+cl_int reduceVector(runtime *rt, cl_command_queue commandQueue,
+                    const reduceKernels *k, reduceOp op, cl_mem x, cl_mem y,
+                    size_t n, double *result, double *nanoseconds);
+
+#endif
@@ -0,0 +1,310 @@
+#include "roofline.h"
+#include "hostAlloc.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  const char *name;
+  double flops, bytes; // per run; bytes as the kernel issues them to memory
+  double seconds;      // best run
+} roofPoint;
+
+// best device time of ROOF_REPS runs, after one untimed warm-up
+static cl_int bestTime(cl_command_queue commandQueue, cl_kernel kernel,
+                       cl_uint dims, const size_t *global,
+                       const size_t *local, double *seconds) {
+  *seconds = INFINITY;
+  for (int r = -1; r < ROOF_REPS; r++) {
+    cl_event done;
+    double nanoseconds;
+    cl_int err = clEnqueueNDRangeKernel(commandQueue, kernel, dims, NULL,
+                                        global, local, 0, NULL, &done);
+    if (checkErr(err, "queued roofline kernel")) {
+      return err;
+    }
+    clWaitForEvents(1, &done);
+    timeProf(&nanoseconds, done);
+    clReleaseEvent(done);
+    if (r >= 0) {
+      *seconds = fmin(*seconds, nanoseconds * 1e-9);
+    }
+  }
+  return CL_SUCCESS;
+}
+
+// the limits the device reports. the nominal peak assumes every compute unit
+// retires its native double width of fmas each cycle, which is a guess: it
+// is printed for comparison & the measured peak is what the roofline uses.
+static void deviceLimits(cl_device_id device) {
+  char name[256];
+  cl_uint units, clock, nativeDouble, nativeFloat, preferredDouble;
+  cl_ulong globalMem, maxAlloc, localMem;
+  clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units,
+                  NULL);
+  clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clock),
+                  &clock, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_NATIVE_VECTOR_WIDTH_DOUBLE,
+                  sizeof(nativeDouble), &nativeDouble, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT,
+                  sizeof(nativeFloat), &nativeFloat, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE,
+                  sizeof(preferredDouble), &preferredDouble, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem),
+                  &globalMem, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc),
+                  &maxAlloc, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMem),
+                  &localMem, NULL);
+
+  printf("%s\n", name);
+  printf("  compute units %u at %u MHz\n", units, clock);
+  printf("  native vector width double %u, float %u; preferred double %u\n",
+         nativeDouble, nativeFloat, preferredDouble);
+  printf("  global memory %.1f GiB, max alloc %.1f GiB, local %.0f KiB\n",
+         globalMem / 1073741824.0, maxAlloc / 1073741824.0, localMem / 1024.0);
+  printf("  nominal double peak %.1f GFLOP/s (units x clock x width x 2)\n",
+         2.0 * units * clock * 1e6 * nativeDouble * 1e-9);
+}
+
+// ROOF_LOCAL, or less where the kernel can't run groups that big
+static cl_int roofLocal(runtime *rt, cl_kernel kernel, size_t *local) {
+  kernelResources resources;
+  cl_int err = kernelInfo(kernel, rt->deviceID, &resources);
+  if (!err && resources.workGroupSize < *local) {
+    *local = resources.workGroupSize;
+  }
+  return err;
+}
+
+// peak_flops over a few work-groups per compute unit
+static cl_int measureFlops(runtime *rt, cl_uint units, double *peak) {
+  size_t local = ROOF_LOCAL, global;
+  cl_int iters = ROOF_ITERS;
+  double s = 0.999999, seconds;
+  cl_kernel kernel = NULL;
+  cl_mem out = NULL;
+  cl_int err;
+  if ((err = runtimeKernel(rt, "roofline.cl", "peak_flops", &kernel))) {
+    return err;
+  }
+  err = roofLocal(rt, kernel, &local);
+  global = (size_t)units * ROOF_GROUPS_PER_CU * local;
+  if (!err &&
+      !(err = runtimeBuffer(rt, global * sizeof(double), CL_MEM_WRITE_ONLY,
+                            &out)) &&
+      !(err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &out)) &&
+      !(err = clSetKernelArg(kernel, 1, sizeof(iters), &iters)) &&
+      !(err = clSetKernelArg(kernel, 2, sizeof(s), &s)) &&
+      !(err = bestTime(rt->queues[0], kernel, 1, &global, &local, &seconds))) {
+    *peak = (double)global * ROOF_ITERS * ROOF_FLOPS_PER_ITER / seconds;
+  }
+  runtimeRecycle(rt, out);
+  clReleaseKernel(kernel);
+  return checkErr(err, "measured peak flops");
+}
+
+// the faster of a streaming read & a copy over one big array
+static cl_int measureBandwidth(runtime *rt, cl_uint units, double *peak) {
+  cl_ulong maxAlloc;
+  clGetDeviceInfo(rt->deviceID, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                  sizeof(maxAlloc), &maxAlloc, NULL);
+  size_t bytes = ROOF_BYTES < maxAlloc ? ROOF_BYTES : maxAlloc;
+  cl_ulong n = bytes / (4 * sizeof(double));
+  bytes = n * 4 * sizeof(double);
+  // one grid for both kernels, of groups either can run
+  size_t local = ROOF_LOCAL, global;
+  cl_kernel readSum = NULL, copy = NULL;
+  cl_mem in = NULL, out = NULL, partial = NULL;
+  double readTime, copyTime;
+  cl_int err;
+  if ((err = runtimeKernel(rt, "roofline.cl", "read_sum", &readSum)) ||
+      (err = runtimeKernel(rt, "roofline.cl", "copy4", &copy)) ||
+      (err = roofLocal(rt, readSum, &local)) ||
+      (err = roofLocal(rt, copy, &local))) {
+    goto cleanup;
+  }
+  global = (size_t)units * ROOF_GROUPS_PER_CU * local;
+  if ((err = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &in)) ||
+      (err = runtimeBuffer(rt, bytes, CL_MEM_WRITE_ONLY, &out)) ||
+      (err = runtimeBuffer(rt, global * sizeof(double), CL_MEM_WRITE_ONLY,
+                           &partial))) {
+    goto cleanup;
+  }
+  // the input only has to exist, so it is filled on the device
+  double zero = 0.0;
+  if ((err = clEnqueueFillBuffer(rt->queues[0], in, &zero, sizeof(zero), 0,
+                                 bytes, 0, NULL, NULL)) ||
+      (err = clSetKernelArg(readSum, 0, sizeof(cl_mem), &in)) ||
+      (err = clSetKernelArg(readSum, 1, sizeof(n), &n)) ||
+      (err = clSetKernelArg(readSum, 2, sizeof(cl_mem), &partial)) ||
+      (err = clSetKernelArg(copy, 0, sizeof(cl_mem), &in)) ||
+      (err = clSetKernelArg(copy, 1, sizeof(n), &n)) ||
+      (err = clSetKernelArg(copy, 2, sizeof(cl_mem), &out)) ||
+      (err = bestTime(rt->queues[0], readSum, 1, &global, &local,
+                      &readTime)) ||
+      (err = bestTime(rt->queues[0], copy, 1, &global, &local, &copyTime))) {
+    goto cleanup;
+  }
+  *peak = fmax(bytes / readTime, 2.0 * bytes / copyTime);
+  printf("  measured read %.1f GB/s, copy %.1f GB/s over %.0f MiB\n",
+         bytes / readTime * 1e-9, 2.0 * bytes / copyTime * 1e-9,
+         bytes / 1048576.0);
+
+cleanup:
+  runtimeRecycle(rt, in);
+  runtimeRecycle(rt, out);
+  runtimeRecycle(rt, partial);
+  if (readSum) {
+    clReleaseKernel(readSum);
+  }
+  if (copy) {
+    clReleaseKernel(copy);
+  }
+  return checkErr(err, "measured bandwidth");
+}
+
+// mult & mult2 at n x n. mult issues two 8-byte loads per fma; mult2 loads
+// each 16x16 tile once for 16 fmas per work-item, 16 times fewer. both store
+// C once. mult2 is skipped unless n is whole tiles.
+static cl_int measureGemm(runtime *rt, int n, roofPoint *points,
+                          int *numPoints) {
+  const char *names[] = {"mult", "mult2"};
+  size_t bytes = (size_t)n * n * sizeof(double);
+  const size_t global[2] = {n, n};
+  double dn = n;
+  double *hA = (double *)hostAlloc(bytes);
+  double *hB = (double *)hostAlloc(bytes);
+  cl_mem dA = NULL, dB = NULL, dC = NULL;
+  cl_int err;
+  initHost(hA, hB, n);
+  if ((err = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dA)) ||
+      (err = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dB)) ||
+      (err = runtimeBuffer(rt, bytes, CL_MEM_WRITE_ONLY, &dC)) ||
+      (err = writeBuffer(dA, hA, bytes, &rt->queues[0])) ||
+      (err = writeBuffer(dB, hB, bytes, &rt->queues[0]))) {
+    goto cleanup;
+  }
+  for (int k = 0; k < 2 && !err; k++) {
+    cl_kernel kernel;
+    kernelResources resources;
+    size_t local[2];
+    roofPoint *p = &points[(*numPoints)];
+    if ((err = runtimeKernel(rt, "matrix.cl", names[k], &kernel))) {
+      break;
+    }
+    if ((err = kernelInfo(kernel, rt->deviceID, &resources))) {
+      clReleaseKernel(kernel);
+      break;
+    }
+    const size_t *groups = kernelLocal(&resources, n, n, local);
+    if (!groups && resources.compiled[0]) {
+      printf("  %s skipped: %d is not a multiple of its %zux%zu work-group\n",
+             names[k], n, resources.compiled[0], resources.compiled[1]);
+      clReleaseKernel(kernel);
+      break;
+    }
+    if (!(err = setArgs(&kernel, n, dA, dB, dC)) &&
+        !(err = bestTime(rt->queues[0], kernel, 2, global, groups,
+                         &p->seconds))) {
+      p->name = names[k];
+      p->flops = 2.0 * dn * dn * dn;
+      p->bytes = (k ? dn * dn * dn : 16.0 * dn * dn * dn) + 8.0 * dn * dn;
+      (*numPoints)++;
+    }
+    clReleaseKernel(kernel);
+  }
+
+cleanup:
+  runtimeRecycle(rt, dA);
+  runtimeRecycle(rt, dB);
+  runtimeRecycle(rt, dC);
+  hostFree(hA);
+  hostFree(hB);
+  return err;
+}
+
+// add & triad from vector.cl: 1 & 2 flops for 24 bytes an element
+static cl_int measureVector(runtime *rt, roofPoint *points, int *numPoints) {
+  const char *names[] = {"add", "triad"};
+  cl_ulong n = ROOF_VECTOR_N;
+  size_t bytes = n * sizeof(double);
+  size_t global = n;
+  double s = 3.0, zero = 0.0;
+  cl_mem dA = NULL, dB = NULL, dC = NULL;
+  cl_int err;
+  if ((err = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dA)) ||
+      (err = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dB)) ||
+      (err = runtimeBuffer(rt, bytes, CL_MEM_WRITE_ONLY, &dC)) ||
+      (err = clEnqueueFillBuffer(rt->queues[0], dA, &zero, sizeof(zero), 0,
+                                 bytes, 0, NULL, NULL)) ||
+      (err = clEnqueueFillBuffer(rt->queues[0], dB, &zero, sizeof(zero), 0,
+                                 bytes, 0, NULL, NULL))) {
+    goto cleanup;
+  }
+  for (int k = 0; k < 2 && !err; k++) {
+    cl_kernel kernel;
+    roofPoint *p = &points[(*numPoints)];
+    if ((err = runtimeKernel(rt, "vector.cl", names[k], &kernel))) {
+      break;
+    }
+    if (!(err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dA)) &&
+        !(err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &dB)) &&
+        !(err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &dC)) &&
+        !(err = clSetKernelArg(kernel, 3, sizeof(n), &n)) &&
+        !(err = k ? clSetKernelArg(kernel, 4, sizeof(s), &s) : CL_SUCCESS) &&
+        !(err = bestTime(rt->queues[0], kernel, 1, &global, NULL,
+                         &p->seconds))) {
+      p->name = names[k];
+      p->flops = (k + 1.0) * n;
+      p->bytes = 24.0 * n;
+      (*numPoints)++;
+    }
+    clReleaseKernel(kernel);
+  }
+
+cleanup:
+  runtimeRecycle(rt, dA);
+  runtimeRecycle(rt, dB);
+  runtimeRecycle(rt, dC);
+  return err;
+}
+
+// the device's limits, its measured roof, then every kernel against it:
+// attainable = min(peak, intensity x bandwidth), and whether the kernel sits
+// left of the ridge (memory bound) or right of it (compute bound)
+cl_int runRoofline(runtime *rt, int n) {
+  roofPoint points[4];
+  int numPoints = 0;
+  double peakFlops = 0.0, peakBytes = 0.0;
+  cl_uint units;
+  cl_int err;
+  clGetDeviceInfo(rt->deviceID, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units),
+                  &units, NULL);
+  deviceLimits(rt->deviceID);
+  if ((err = measureFlops(rt, units, &peakFlops)) ||
+      (err = measureBandwidth(rt, units, &peakBytes))) {
+    return err;
+  }
+  printf("  measured peak %.1f GFLOP/s, %.1f GB/s, ridge at %.2f flop/byte\n",
+         peakFlops * 1e-9, peakBytes * 1e-9, peakFlops / peakBytes);
+
+  if ((err = measureGemm(rt, n, points, &numPoints)) ||
+      (err = measureVector(rt, points, &numPoints))) {
+    return err;
+  }
+  printf("\n%-6s %10s %10s %10s %12s %8s %8s  %s\n", "kernel", "flop/byte",
+         "GFLOP/s", "GB/s", "attainable", "% roof", "% peak", "bound");
+  for (int p = 0; p < numPoints; p++) {
+    double intensity = points[p].flops / points[p].bytes;
+    double achieved = points[p].flops / points[p].seconds;
+    double attainable = fmin(peakFlops, intensity * peakBytes);
+    printf("%-6s %10.3f %10.2f %10.2f %12.2f %7.1f%% %7.1f%%  %s\n",
+           points[p].name, intensity, achieved * 1e-9,
+           points[p].bytes / points[p].seconds * 1e-9, attainable * 1e-9,
+           100.0 * achieved / attainable, 100.0 * achieved / peakFlops,
+           intensity < peakFlops / peakBytes ? "memory" : "compute");
+  }
+  return CL_SUCCESS;
+}
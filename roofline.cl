@@ -0,0 +1,38 @@
+//Roofline microkernels: peak double FLOP/s & global memory bandwidth
+
+//four independent mad chains of double8 per work-item, 64 flops an
+//iteration, so the pipes never wait on a result & nothing touches memory.
+//s is just below 1 so the chains neither overflow nor vanish.
+__kernel void peak_flops(__global double *out, const int iters, const double s){
+	const double seed = get_global_id(0) * 1e-9;
+	const double8 m = (double8)(s);
+	double8 a = (double8)(seed);
+	double8 b = a + 0.25;
+	double8 c = a + 0.5;
+	double8 d = a + 0.75;
+	for (int i = 0; i < iters; i++){
+		a = mad(a, m, m);
+		b = mad(b, m, m);
+		c = mad(c, m, m);
+		d = mad(d, m, m);
+	}
+	//one store keeps the loop from being optimised away
+	double8 sum = a + b + c + d;
+	out[get_global_id(0)] = sum.s0 + sum.s1 + sum.s2 + sum.s3 + sum.s4 + sum.s5 + sum.s6 + sum.s7;
+}
+
+//read bandwidth: a fixed grid sums n double4s, one partial per work-item
+__kernel void read_sum(__global const double4 *in, const ulong n, __global double *out){
+	double4 sum = (double4)(0.0);
+	for (size_t i = get_global_id(0); i < n; i += get_global_size(0)){
+		sum += in[i];
+	}
+	out[get_global_id(0)] = sum.x + sum.y + sum.z + sum.w;
+}
+
+//copy bandwidth: n double4s read & written once
+__kernel void copy4(__global const double4 *in, const ulong n, __global double4 *out){
+	for (size_t i = get_global_id(0); i < n; i += get_global_size(0)){
+		out[i] = in[i];
+	}
+}
@@ -0,0 +1,19 @@
+// roofline of the runtime's device: its limits, measured peak FLOP/s and
+// bandwidth, and where the matrix & vector kernels sit under them
+
+#ifndef ROOFLINE_H_
+#define ROOFLINE_H_
+
+#include "runtime.h"
+
+#define ROOF_REPS 5              // timed runs of every kernel, best is kept
+#define ROOF_ITERS 4096          // mad iterations per work-item in peak_flops
+#define ROOF_FLOPS_PER_ITER 64   // 4 chains of double8 mads
+#define ROOF_GROUPS_PER_CU 64    // work-groups per compute unit, microkernels
+#define ROOF_LOCAL 256           // work-group size of the microkernels
+#define ROOF_BYTES (256 << 20)   // bandwidth array, capped by the max alloc
+#define ROOF_VECTOR_N (1 << 24)  // elements of the vector kernels placed
+
+cl_int runRoofline(runtime *rt, int n);
+
+#endif
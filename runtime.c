@@ -0,0 +1,283 @@
+#include "runtime.h"
+#include "deviceSelect.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// FNV-1a; pass 0 to start a hash or a previous result to extend it
+unsigned long long runtimeHash(const void *data, size_t size,
+                               unsigned long long hash) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  if (hash == 0) {
+    hash = FNV_OFFSET;
+  }
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+// the device a spec picks, NULL for the one from --device or CLMM_DEVICE,
+// with a context & profiling in-order queues on it. a failed init leaves
+// nothing to release.
+cl_int runtimeInit(runtime *rt, const char *deviceSpec) {
+  cl_platform_id platformID;
+  cl_device_id deviceID;
+  cl_int err;
+  memset(rt, 0, sizeof(*rt));
+  if ((err = selectDevice(deviceSpec, &platformID, &deviceID))) {
+    return err;
+  }
+  return runtimeInitDevice(rt, platformID, deviceID);
+}
+
+// the same on a device already chosen, as for one of several devices
+cl_int runtimeInitDevice(runtime *rt, cl_platform_id platformID,
+                         cl_device_id deviceID) {
+  cl_int err;
+  memset(rt, 0, sizeof(*rt));
+  rt->platformID = platformID;
+  rt->deviceID = deviceID;
+  if ((err = createContext(&rt->context, &rt->platformID, &rt->deviceID))) {
+    return err;
+  }
+  for (int q = 0; q < RUNTIME_QUEUES; q++) {
+    if ((err = createQueue(&rt->queues[q], &rt->context, &rt->deviceID, 0,
+                           1))) {
+      runtimeShutdown(rt);
+      return err;
+    }
+  }
+  return CL_SUCCESS;
+}
+
+// write a program binary to a fresh temporary file, then rename it over
+// path, so no other process or thread ever loads a partly written one
+static void saveBinary(const char *path, const unsigned char *binary,
+                       size_t size) {
+  char temp[560];
+  snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+  int fd = mkstemp(temp);
+  FILE *cache = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  if (!cache) {
+    if (fd >= 0) {
+      close(fd);
+      remove(temp);
+    }
+    return;
+  }
+  int written = fwrite(binary, 1, size, cache) == size;
+  if (fclose(cache) != 0 || !written || rename(temp, path) != 0) {
+    remove(temp);
+  }
+}
+
+// program for some source. built programs are kept by a hash of the source,
+// device & driver, and their binaries are cached on disk under the same
+// hash, so a source is only compiled the first time a device sees it.
+cl_int runtimeProgramSource(runtime *rt, const char *source, size_t size,
+                            cl_program *program) {
+  char text[256], file[64], path[512];
+  unsigned long long hash = runtimeHash(source, size, 0);
+  clGetDeviceInfo(rt->deviceID, CL_DEVICE_NAME, sizeof(text), text, NULL);
+  hash = runtimeHash(text, strlen(text), hash);
+  clGetDeviceInfo(rt->deviceID, CL_DRIVER_VERSION, sizeof(text), text, NULL);
+  hash = runtimeHash(text, strlen(text), hash);
+  for (int p = 0; p < rt->numPrograms; p++) {
+    if (rt->programs[p].hash == hash) {
+      *program = rt->programs[p].program;
+      return CL_SUCCESS;
+    }
+  }
+  snprintf(file, sizeof(file), "kernel-%016llx.bin", hash);
+  cachePath(path, sizeof(path), file);
+
+  cl_int err = CL_INVALID_PROGRAM;
+  double start = traceBegin();
+  FILE *cache = fopen(path, "rb");
+  long cached = -1;
+  if (cache && fseek(cache, 0, SEEK_END) == 0) {
+    cached = ftell(cache);
+  }
+  unsigned char *binary =
+      cached > 0 ? (unsigned char *)malloc((size_t)cached) : NULL;
+  if (cache) {
+    rewind(cache);
+    if (binary && fread(binary, 1, (size_t)cached, cache) != (size_t)cached) {
+      free(binary);
+      binary = NULL;
+    }
+    fclose(cache);
+  }
+  if (binary) {
+    size_t binarySize = (size_t)cached;
+    cl_int status;
+    *program = clCreateProgramWithBinary(rt->context, 1, &rt->deviceID,
+                                         &binarySize,
+                                         (const unsigned char **)&binary,
+                                         &status, &err);
+    free(binary);
+    double built = wallTime();
+    if (err == CL_SUCCESS && (status != CL_SUCCESS ||
+                              clBuildProgram(*program, 1, &rt->deviceID, NULL,
+                                             NULL, NULL) != CL_SUCCESS)) {
+      clReleaseProgram(*program);
+      err = CL_INVALID_BINARY;
+    }
+    rt->buildTime = wallTime() - built;
+    rt->programsLoaded += err == CL_SUCCESS;
+    traceEnd("loadBinary", start);
+  }
+
+  if (err != CL_SUCCESS) {
+    if ((err = createProgramFromSource(program, &rt->context, source,
+                                       &size))) {
+      return err;
+    }
+    if ((err = buildProgram(program, &rt->deviceID))) {
+      clReleaseProgram(*program);
+      return err;
+    }
+    rt->programsBuilt++;
+    rt->buildTime = lastBuildTime();
+    size_t binarySize = 0;
+    clGetProgramInfo(*program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize),
+                     &binarySize, NULL);
+    binary = binarySize ? (unsigned char *)malloc(binarySize) : NULL;
+    if (binary &&
+        clGetProgramInfo(*program, CL_PROGRAM_BINARIES, sizeof(binary),
+                         &binary, NULL) == CL_SUCCESS) {
+      saveBinary(path, binary, binarySize);
+    }
+    free(binary);
+  }
+
+  // the runtime owns the program from here on
+  runtimeProgramEntry *programs = (runtimeProgramEntry *)realloc(
+      rt->programs, (rt->numPrograms + 1) * sizeof(runtimeProgramEntry));
+  if (!programs) {
+    clReleaseProgram(*program);
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+  rt->programs = programs;
+  rt->programs[rt->numPrograms].hash = hash;
+  rt->programs[rt->numPrograms++].program = *program;
+  return CL_SUCCESS;
+}
+
+// program for a kernel file, read & built on first use
+cl_int runtimeProgram(runtime *rt, const char *filename, cl_program *program) {
+  size_t size;
+  char *source = kernelFromFile(&size, (char *)filename);
+  if (!source) {
+    return CL_INVALID_VALUE;
+  }
+  cl_int err = runtimeProgramSource(rt, source, size, program);
+  free(source);
+  return err;
+}
+
+// a kernel from a file; the kernel is the caller's to release
+cl_int runtimeKernel(runtime *rt, const char *filename, const char *name,
+                     cl_kernel *kernel) {
+  cl_program program;
+  cl_int err = runtimeProgram(rt, filename, &program);
+  if (err) {
+    return err;
+  }
+  return createKernel(kernel, &program, (char *)name);
+}
+
+// a device buffer of at least size bytes: the smallest idle one with the
+// same flags that is no more than RUNTIME_SLACK times too big, else a new one
+cl_int runtimeBuffer(runtime *rt, size_t size, cl_mem_flags flags,
+                     cl_mem *buffer) {
+  int best = -1;
+  for (int b = 0; b < rt->numPooled; b++) {
+    runtimePoolEntry *e = &rt->pool[b];
+    if (e->flags == flags && e->size >= size &&
+        e->size <= size * RUNTIME_SLACK &&
+        (best < 0 || e->size < rt->pool[best].size)) {
+      best = b;
+    }
+  }
+  if (best >= 0) {
+    // the pool stays oldest first, so a full one drops the longest idle
+    *buffer = rt->pool[best].buffer;
+    memmove(&rt->pool[best], &rt->pool[best + 1],
+            (--rt->numPooled - best) * sizeof(runtimePoolEntry));
+    rt->buffersReused++;
+    return CL_SUCCESS;
+  }
+  cl_int err = createBuffer(buffer, size, flags, &rt->context);
+  rt->buffersCreated += err == CL_SUCCESS;
+  return err;
+}
+
+// hand a buffer back for reuse once the commands using it have finished, or
+// are all on the one queue its next user will enqueue on. a full pool drops
+// its oldest buffer.
+void runtimeRecycle(runtime *rt, cl_mem buffer) {
+  if (!buffer) {
+    return;
+  }
+  if (rt->numPooled == RUNTIME_POOL) {
+    clReleaseMemObject(rt->pool[0].buffer);
+    memmove(&rt->pool[0], &rt->pool[1],
+            --rt->numPooled * sizeof(runtimePoolEntry));
+  }
+  runtimePoolEntry *e = &rt->pool[rt->numPooled++];
+  e->buffer = buffer;
+  clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(e->size), &e->size, NULL);
+  clGetMemObjectInfo(buffer, CL_MEM_FLAGS, sizeof(e->flags), &e->flags, NULL);
+}
+
+// release every idle pooled buffer, to give the device its memory back
+// before retrying work that ran out of it
+void runtimeTrim(runtime *rt) {
+  for (int b = 0; b < rt->numPooled; b++) {
+    clReleaseMemObject(rt->pool[b].buffer);
+  }
+  rt->numPooled = 0;
+}
+
+// next queue round-robin; work on different queues may overlap, so order
+// across them with events
+cl_command_queue runtimeQueue(runtime *rt) {
+  cl_command_queue queue = rt->queues[rt->nextQueue];
+  rt->nextQueue = (rt->nextQueue + 1) % RUNTIME_QUEUES;
+  return queue;
+}
+
+// wait for everything submitted on every queue
+cl_int runtimeFinish(runtime *rt) {
+  cl_int err = CL_SUCCESS;
+  for (int q = 0; q < RUNTIME_QUEUES; q++) {
+    cl_int finished = clFinish(rt->queues[q]);
+    err = err ? err : finished;
+  }
+  return checkErr(err, "finished queues");
+}
+
+void runtimeShutdown(runtime *rt) {
+  for (int q = 0; q < RUNTIME_QUEUES; q++) {
+    if (rt->queues[q]) {
+      clFinish(rt->queues[q]);
+      clReleaseCommandQueue(rt->queues[q]);
+    }
+  }
+  runtimeTrim(rt);
+  for (int p = 0; p < rt->numPrograms; p++) {
+    clReleaseProgram(rt->programs[p].program);
+  }
+  free(rt->programs);
+  if (rt->context) {
+    clReleaseContext(rt->context);
+  }
+  memset(rt, 0, sizeof(*rt));
+}
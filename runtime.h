@@ -0,0 +1,60 @@
+// one device shared by matrixOp, vecOp & libclmatmul: its context, in-order
+// queues for async submission, programs built once & cached on disk, and a
+// pool of device buffers reused between calls
+
+#ifndef RUNTIME_H_
+#define RUNTIME_H_
+
+#include "clHelper.h"
+
+#define RUNTIME_QUEUES 3   // in-order queues work is spread over
+#define RUNTIME_POOL 32    // idle buffers kept for reuse
+#define RUNTIME_SLACK 2    // a pooled buffer may be up to 2x the request
+
+typedef struct {
+  unsigned long long hash;
+  cl_program program;
+} runtimeProgramEntry;
+
+typedef struct {
+  cl_mem buffer;
+  size_t size;
+  cl_mem_flags flags;
+} runtimePoolEntry;
+
+typedef struct runtime {
+  cl_platform_id platformID;
+  cl_device_id deviceID;
+  cl_context context;
+  cl_command_queue queues[RUNTIME_QUEUES];
+  int nextQueue;
+  runtimeProgramEntry *programs; // every program built, by source hash
+  int numPrograms;
+  runtimePoolEntry pool[RUNTIME_POOL];
+  int numPooled;
+  // statistics
+  int programsBuilt, programsLoaded; // compiled here or read from the cache
+  int buffersCreated, buffersReused;
+  double buildTime; // seconds the last new program took to build
+} runtime;
+
+unsigned long long runtimeHash(const void *data, size_t size,
+                               unsigned long long hash);
+
+cl_int runtimeInit(runtime *rt, const char *deviceSpec);
+cl_int runtimeInitDevice(runtime *rt, cl_platform_id platformID,
+                         cl_device_id deviceID);
+cl_int runtimeProgramSource(runtime *rt, const char *source, size_t size,
+                            cl_program *program);
+cl_int runtimeProgram(runtime *rt, const char *filename, cl_program *program);
+cl_int runtimeKernel(runtime *rt, const char *filename, const char *name,
+                     cl_kernel *kernel);
+cl_int runtimeBuffer(runtime *rt, size_t size, cl_mem_flags flags,
+                     cl_mem *buffer);
+void runtimeRecycle(runtime *rt, cl_mem buffer);
+void runtimeTrim(runtime *rt);
+cl_command_queue runtimeQueue(runtime *rt);
+cl_int runtimeFinish(runtime *rt);
+void runtimeShutdown(runtime *rt);
+
+#endif
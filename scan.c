@@ -0,0 +1,142 @@
+#include "scan.h"
+#include "trace.h"
+#include <stdio.h>
+
+typedef struct {
+  runtime *rt;
+  const scanKernels *k;
+  size_t elementSize;
+  cl_event events[2 * SCAN_MAX_LEVELS];
+  int numEvents;
+} scanPlan;
+
+// largest power of two work-group both kernels allow, up to SCAN_LOCAL
+static size_t localSize(cl_kernel kernel, cl_device_id device) {
+  size_t max = SCAN_LOCAL;
+  size_t local = 1;
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                           sizeof(max), &max, NULL);
+  while (local * 2 <= max && local * 2 <= SCAN_LOCAL) {
+    local *= 2;
+  }
+  return local;
+}
+
+// scan blocks of 2 * local into out, then scan their totals one level up
+// and add them back. in & out may be the same buffer.
+static cl_int scanLevel(cl_command_queue commandQueue, scanPlan *plan,
+                        cl_mem in, cl_mem out, size_t n, int inclusive,
+                        int level) {
+  const scanKernels *k = plan->k;
+  size_t block = 2 * k->local;
+  size_t blocks = (n + block - 1) / block;
+  size_t global = blocks * k->local;
+  cl_ulong length = n, blockLength = block;
+  cl_mem sums;
+  cl_event *scanned, *added;
+  cl_int err;
+  if (level >= SCAN_MAX_LEVELS) {
+    return CL_INVALID_BUFFER_SIZE;
+  }
+  if ((err = runtimeBuffer(plan->rt, blocks * plan->elementSize,
+                           CL_MEM_READ_WRITE, &sums))) {
+    return err;
+  }
+
+  scanned = &plan->events[plan->numEvents++];
+  if ((err = clSetKernelArg(k->scan, 0, sizeof(length), &length)) ||
+      (err = clSetKernelArg(k->scan, 1, sizeof(cl_mem), &in)) ||
+      (err = clSetKernelArg(k->scan, 2, sizeof(cl_mem), &out)) ||
+      (err = clSetKernelArg(k->scan, 3, sizeof(cl_mem), &sums)) ||
+      (err = clSetKernelArg(k->scan, 4, block * plan->elementSize, NULL)) ||
+      (err = clSetKernelArg(k->scan, 5, sizeof(int), &inclusive)) ||
+      (err = clEnqueueNDRangeKernel(commandQueue, k->scan, 1, NULL, &global,
+                                    &k->local, 0, NULL, scanned))) {
+    goto cleanup;
+  }
+  traceLaunch(*scanned, k->scan);
+
+  if (blocks > 1) {
+    // the totals scan exclusively, so block 0 adds nothing
+    if ((err = scanLevel(commandQueue, plan, sums, sums, blocks, 0,
+                         level + 1))) {
+      goto cleanup;
+    }
+    // arguments are set again since the level above reused the kernel
+    added = &plan->events[plan->numEvents++];
+    if ((err = clSetKernelArg(k->add, 0, sizeof(length), &length)) ||
+        (err = clSetKernelArg(k->add, 1, sizeof(cl_mem), &out)) ||
+        (err = clSetKernelArg(k->add, 2, sizeof(cl_mem), &sums)) ||
+        (err = clSetKernelArg(k->add, 3, sizeof(blockLength),
+                              &blockLength)) ||
+        (err = clEnqueueNDRangeKernel(commandQueue, k->add, 1, NULL, &n,
+                                      NULL, 0, NULL, added))) {
+      goto cleanup;
+    }
+    traceLaunch(*added, k->add);
+  }
+
+cleanup:
+  // its next user is queued behind these kernels on the same in-order queue
+  runtimeRecycle(plan->rt, sums);
+  return err;
+}
+
+// both kernels of one element type from the runtime's scan.cl
+cl_int scanKernelsCreate(runtime *rt, int isInt, scanKernels *k) {
+  cl_int err;
+  k->isInt = isInt;
+  k->scan = k->add = NULL;
+  if ((err = runtimeKernel(rt, "scan.cl", isInt ? "scan_i" : "scan_d",
+                           &k->scan)) ||
+      (err = runtimeKernel(rt, "scan.cl",
+                           isInt ? "add_offsets_i" : "add_offsets_d",
+                           &k->add))) {
+    scanKernelsRelease(k);
+    return err;
+  }
+  k->local = localSize(k->scan, rt->deviceID);
+  return CL_SUCCESS;
+}
+
+void scanKernelsRelease(scanKernels *k) {
+  if (k->scan) {
+    clReleaseKernel(k->scan);
+    k->scan = NULL;
+  }
+  if (k->add) {
+    clReleaseKernel(k->add);
+    k->add = NULL;
+  }
+}
+
+// inclusive or exclusive prefix sums of n doubles or ints, as k was made
+// for. the block totals of every level come from the runtime's pool.
+// *nanoseconds gets the device time of every level.
+cl_int scanVector(runtime *rt, cl_command_queue commandQueue,
+                  const scanKernels *k, int inclusive, cl_mem in, cl_mem out,
+                  size_t n, double *nanoseconds) {
+  scanPlan plan = {rt, k, k->isInt ? sizeof(cl_int) : sizeof(cl_double),
+                   {NULL}, 0};
+  cl_int err = scanLevel(commandQueue, &plan, in, out, n, inclusive, 0);
+  if (!err) {
+    err = clFinish(commandQueue);
+  }
+  *nanoseconds = 0.0;
+  for (int e = 0; !err && e < plan.numEvents; e++) {
+    cl_ulong start, end;
+    clGetEventProfilingInfo(plan.events[e], CL_PROFILING_COMMAND_START,
+                            sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(plan.events[e], CL_PROFILING_COMMAND_END,
+                            sizeof(end), &end, NULL);
+    *nanoseconds += end - start;
+  }
+
+  clFinish(commandQueue);
+  for (int e = 0; e < plan.numEvents; e++) {
+    if (plan.events[e]) {
+      clReleaseEvent(plan.events[e]);
+    }
+  }
+  return err;
+}
@@ -0,0 +1,62 @@
+//Work-efficient (Blelloch) prefix sums over double & int
+//Each work-group scans a block of twice its size in local memory and leaves
+//the block total in sums; the host scans the totals the same way and adds
+//them back with add_offsets. Local sizes must be powers of two.
+
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+#define SCAN(NAME, ADDNAME, T) \
+__kernel void NAME(const ulong n, __global const T *in, __global T *out, \
+		__global T *sums, __local T *tmp, const int inclusive){ \
+	const size_t lid = get_local_id(0); \
+	const size_t L = get_local_size(0); \
+	const size_t base = get_group_id(0) * 2 * L; \
+	T a = base + lid < n ? in[base + lid] : 0; \
+	T b = base + lid + L < n ? in[base + lid + L] : 0; \
+	tmp[lid] = a; \
+	tmp[lid + L] = b; \
+	/*up-sweep: partial sums up a balanced tree*/ \
+	size_t offset = 1; \
+	for (size_t d = L; d > 0; d >>= 1){ \
+		barrier(CLK_LOCAL_MEM_FENCE); \
+		if (lid < d){ \
+			tmp[offset * (2 * lid + 2) - 1] += tmp[offset * (2 * lid + 1) - 1]; \
+		} \
+		offset <<= 1; \
+	} \
+	if (lid == 0){ \
+		sums[get_group_id(0)] = tmp[2 * L - 1]; \
+		tmp[2 * L - 1] = 0; \
+	} \
+	/*down-sweep: push the prefixes back down*/ \
+	for (size_t d = 1; d <= L; d <<= 1){ \
+		offset >>= 1; \
+		barrier(CLK_LOCAL_MEM_FENCE); \
+		if (lid < d){ \
+			size_t i = offset * (2 * lid + 1) - 1; \
+			size_t j = offset * (2 * lid + 2) - 1; \
+			T t = tmp[i]; \
+			tmp[i] = tmp[j]; \
+			tmp[j] += t; \
+		} \
+	} \
+	barrier(CLK_LOCAL_MEM_FENCE); \
+	if (base + lid < n){ \
+		out[base + lid] = tmp[lid] + (inclusive ? a : 0); \
+	} \
+	if (base + lid + L < n){ \
+		out[base + lid + L] = tmp[lid + L] + (inclusive ? b : 0); \
+	} \
+} \
+\
+/*sums holds the exclusive scan of the block totals*/ \
+__kernel void ADDNAME(const ulong n, __global T *out, __global const T *sums, \
+		const ulong block){ \
+	size_t i = get_global_id(0); \
+	if (i < n){ \
+		out[i] += sums[i / block]; \
+	} \
+}
+
+SCAN(scan_d, add_offsets_d, double)
+SCAN(scan_i, add_offsets_i, int)
@@ -0,0 +1,25 @@
+// multi-level prefix sums over device vectors, kernels in scan.cl
+
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include "runtime.h"
+
+#define SCAN_LOCAL 256     // largest work-group, each scans twice as many
+#define SCAN_MAX_LEVELS 8  // 512^8 elements is more than any device holds
+
+// the kernels of one element type, made once & reused by every scan
+typedef struct {
+  int isInt;
+  cl_kernel scan, add;
+  size_t local; // work-group of both
+} scanKernels;
+
+cl_int scanKernelsCreate(runtime *rt, int isInt, scanKernels *k);
+void scanKernelsRelease(scanKernels *k);
+
+cl_int scanVector(runtime *rt, cl_command_queue commandQueue,
+                  const scanKernels *k, int inclusive, cl_mem in, cl_mem out,
+                  size_t n, double *nanoseconds);
+
+#endif
@@ -0,0 +1,70 @@
+#include "strided.h"
+
+// column-major rows x cols matrix with leading dimension ld
+stridedView viewMatrix(cl_mem buffer, size_t offset, size_t ld) {
+  stridedView v = {buffer, offset, 1, (long)ld, 0};
+  return v;
+}
+
+// n elements stride apart, one per row: a matrix column is stride 1 and a
+// row stride ld. in a matrix op it is repeated across every column.
+stridedView viewVector(cl_mem buffer, size_t offset, long stride) {
+  stridedView v = {buffer, offset, stride, 0, BROADCAST_COLS};
+  return v;
+}
+
+// a row vector with one element per column, repeated down every row
+stridedView viewRow(cl_mem buffer, size_t offset, long stride) {
+  stridedView v = {buffer, offset, 0, stride, BROADCAST_ROWS};
+  return v;
+}
+
+static cl_int setView(cl_kernel kernel, cl_uint first, stridedView v) {
+  cl_ulong offset = v.offset;
+  cl_long rowStride = v.broadcast & BROADCAST_ROWS ? 0 : v.rowStride;
+  cl_long colStride = v.broadcast & BROADCAST_COLS ? 0 : v.colStride;
+  cl_int err;
+  if ((err = clSetKernelArg(kernel, first, sizeof(cl_mem), &v.buffer)) ||
+      (err = clSetKernelArg(kernel, first + 1, sizeof(offset), &offset)) ||
+      (err = clSetKernelArg(kernel, first + 2, sizeof(rowStride),
+                            &rowStride)) ||
+      (err = clSetKernelArg(kernel, first + 3, sizeof(colStride),
+                            &colStride))) {
+    return err;
+  }
+  return CL_SUCCESS;
+}
+
+// Z = alpha * X op Y over rows x cols, on the strided kernel of vector.cl.
+// Z may be the same view as Y, as axpy does; Y is unused by STRIDED_SCALE.
+cl_int stridedApply(cl_command_queue commandQueue, cl_kernel kernel,
+                    stridedOp op, double alpha, size_t rows, size_t cols,
+                    stridedView X, stridedView Y, stridedView Z,
+                    cl_event *event) {
+  cl_int code = op;
+  size_t global[2] = {rows, cols};
+  cl_int err;
+  if ((err = clSetKernelArg(kernel, 0, sizeof(code), &code)) ||
+      (err = clSetKernelArg(kernel, 1, sizeof(alpha), &alpha)) ||
+      (err = setView(kernel, 2, X)) || (err = setView(kernel, 6, Y)) ||
+      (err = setView(kernel, 10, Z))) {
+    return err;
+  }
+  return clEnqueueNDRangeKernel(commandQueue, kernel, 2, NULL, global, NULL, 0,
+                                NULL, event);
+}
+
+// Y = alpha * X + Y over n elements
+cl_int stridedAxpy(cl_command_queue commandQueue, cl_kernel kernel, size_t n,
+                   double alpha, stridedView X, stridedView Y,
+                   cl_event *event) {
+  return stridedApply(commandQueue, kernel, STRIDED_ADD, alpha, n, 1, X, Y, Y,
+                      event);
+}
+
+// X = alpha * X over n elements
+cl_int stridedScal(cl_command_queue commandQueue, cl_kernel kernel, size_t n,
+                   double alpha, stridedView X, cl_event *event) {
+  return stridedApply(commandQueue, kernel, STRIDED_SCALE, alpha, n, 1, X, X,
+                      X, event);
+}
@@ -0,0 +1,36 @@
+// elementwise ops over strided & broadcast views of device buffers, with the
+// strided kernel in vector.cl. nothing is packed on the host.
+
+#ifndef STRIDED_H_
+#define STRIDED_H_
+
+#include <CL/opencl.h>
+
+#define BROADCAST_ROWS 1 // same element for every row: rowStride ignored
+#define BROADCAST_COLS 2 // same element for every column: colStride ignored
+
+typedef enum { STRIDED_ADD, STRIDED_MULT, STRIDED_SCALE } stridedOp;
+
+// element (r, c) is buffer[offset + r * rowStride + c * colStride]
+typedef struct {
+  cl_mem buffer;
+  size_t offset;
+  long rowStride, colStride;
+  int broadcast;
+} stridedView;
+
+stridedView viewMatrix(cl_mem buffer, size_t offset, size_t ld);
+stridedView viewVector(cl_mem buffer, size_t offset, long stride);
+stridedView viewRow(cl_mem buffer, size_t offset, long stride);
+
+cl_int stridedApply(cl_command_queue commandQueue, cl_kernel kernel,
+                    stridedOp op, double alpha, size_t rows, size_t cols,
+                    stridedView X, stridedView Y, stridedView Z,
+                    cl_event *event);
+cl_int stridedAxpy(cl_command_queue commandQueue, cl_kernel kernel, size_t n,
+                   double alpha, stridedView X, stridedView Y,
+                   cl_event *event);
+cl_int stridedScal(cl_command_queue commandQueue, cl_kernel kernel, size_t n,
+                   double alpha, stridedView X, cl_event *event);
+
+#endif
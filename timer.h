@@ -0,0 +1,16 @@
+// wall clock timing shared by the host code
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <time.h>
+
+// seconds from a monotonic clock; unlike clock() this is wall time and keeps
+// counting while other threads or the device do the work
+static inline double wallTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif
@@ -0,0 +1,248 @@
+#include "trace.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { MAX_TRACKS = 64 }; // devices & queues told apart in the trace
+
+typedef struct {
+  cl_event event;
+  char name[TRACE_NAME];
+  double host; // wall time just after the enqueue returned
+  int device, queue; // tracks, looked up while the queue is still alive
+} traceCommandEntry;
+
+typedef struct {
+  char name[TRACE_NAME];
+  double start, end;
+  int thread;
+} traceSpanEntry;
+
+int traceState = -1;
+static char tracePath[512];
+static double traceStart;
+static traceCommandEntry *commands;
+static int numCommands, commandSpace;
+static traceSpanEntry *spans;
+static int numSpans, spanSpace;
+static int numThreads;
+static void *devices[MAX_TRACKS], *queues[MAX_TRACKS];
+static char deviceNames[MAX_TRACKS][256];
+static int numDevices, numQueues;
+static __thread int thread; // host thread id in the trace, 0 until first span
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+// reads CLMM_TRACE once. returns 1 if tracing, and arranges the write at exit
+int traceSetup(void) {
+  pthread_mutex_lock(&traceLock);
+  if (traceState < 0) {
+    const char *path = getenv(TRACE_ENV);
+    traceState = path && *path;
+    if (traceState) {
+      snprintf(tracePath, sizeof(tracePath), "%s", path);
+      traceStart = wallTime();
+      atexit(traceFlush);
+    }
+  }
+  pthread_mutex_unlock(&traceLock);
+  return traceState;
+}
+
+static const char *commandName(cl_command_type type) {
+  switch (type) {
+  case CL_COMMAND_NDRANGE_KERNEL:
+    return "kernel";
+  case CL_COMMAND_WRITE_BUFFER:
+  case CL_COMMAND_WRITE_BUFFER_RECT:
+    return "write";
+  case CL_COMMAND_READ_BUFFER:
+  case CL_COMMAND_READ_BUFFER_RECT:
+    return "read";
+  case CL_COMMAND_MAP_BUFFER:
+    return "map";
+  case CL_COMMAND_UNMAP_MEM_OBJECT:
+    return "unmap";
+  case CL_COMMAND_COPY_BUFFER:
+  case CL_COMMAND_COPY_BUFFER_RECT:
+    return "copy";
+  case CL_COMMAND_FILL_BUFFER:
+    return "fill";
+  default:
+    return "command";
+  }
+}
+
+// index of item in list, added at the end if it is new. past max items the
+// last one is shared.
+static int indexOf(void **list, int *count, int max, void *item) {
+  for (int i = 0; i < *count; i++) {
+    if (list[i] == item) {
+      return i;
+    }
+  }
+  if (*count == max) {
+    return max - 1;
+  }
+  list[*count] = item;
+  return (*count)++;
+}
+
+// the queue, device & command type are read here rather than at exit, when
+// the runtime that owned the queue may have released it. a later queue at a
+// released one's address shares its track.
+void traceRecord(cl_event event, const char *name, int retain) {
+  double host = wallTime();
+  cl_command_queue queue = NULL;
+  cl_device_id device = NULL;
+  cl_command_type type = 0;
+  if (retain) {
+    clRetainEvent(event);
+  }
+  clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, NULL);
+  clGetEventInfo(event, CL_EVENT_COMMAND_TYPE, sizeof(type), &type, NULL);
+  clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+  pthread_mutex_lock(&traceLock);
+  if (numCommands == commandSpace) {
+    commandSpace = commandSpace ? 2 * commandSpace : 256;
+    commands = (traceCommandEntry *)realloc(
+        commands, commandSpace * sizeof(traceCommandEntry));
+  }
+  traceCommandEntry *c = &commands[numCommands++];
+  c->event = event;
+  c->host = host;
+  snprintf(c->name, TRACE_NAME, "%s", name ? name : commandName(type));
+  int known = numDevices;
+  c->device = indexOf(devices, &numDevices, MAX_TRACKS, device);
+  if (numDevices > known) {
+    snprintf(deviceNames[c->device], sizeof(deviceNames[0]), "device");
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(deviceNames[0]),
+                    deviceNames[c->device], NULL);
+  }
+  c->queue = indexOf(queues, &numQueues, MAX_TRACKS, queue);
+  pthread_mutex_unlock(&traceLock);
+}
+
+void traceRecordLaunch(cl_event event, cl_kernel kernel) {
+  char name[TRACE_NAME] = "kernel";
+  clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, NULL);
+  traceRecord(event, name, 1);
+}
+
+void traceSpan(const char *name, double start) {
+  double end = wallTime();
+  pthread_mutex_lock(&traceLock);
+  if (!thread) {
+    thread = ++numThreads;
+  }
+  if (numSpans == spanSpace) {
+    spanSpace = spanSpace ? 2 * spanSpace : 256;
+    spans = (traceSpanEntry *)realloc(spans,
+                                      spanSpace * sizeof(traceSpanEntry));
+  }
+  traceSpanEntry *s = &spans[numSpans++];
+  snprintf(s->name, TRACE_NAME, "%s", name);
+  s->start = start;
+  s->end = end;
+  s->thread = thread;
+  pthread_mutex_unlock(&traceLock);
+}
+
+// written at exit. the device clock is put on the host's by the smallest
+// gap between an enqueue returning on the host & the device stamping it
+// queued; that gap is the closest the two clocks come to one instant.
+// commands that never finished have no profile & are left out.
+void traceFlush(void) {
+  double offset[MAX_TRACKS];
+  cl_ulong stamps[4];
+  const cl_profiling_info info[4] = {
+      CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT,
+      CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END};
+
+  pthread_mutex_lock(&traceLock);
+  FILE *file = traceState > 0 ? fopen(tracePath, "w") : NULL;
+  if (traceState > 0 && !file) {
+    fprintf(stderr, "cannot write trace %s\n", tracePath);
+  }
+  for (int d = 0; d < MAX_TRACKS; d++) {
+    offset[d] = INFINITY;
+  }
+
+  // first pass: the clock offset of each device
+  for (int i = 0; file && i < numCommands; i++) {
+    if (clGetEventProfilingInfo(commands[i].event, info[0], sizeof(cl_ulong),
+                                &stamps[0], NULL) == CL_SUCCESS) {
+      double gap = (commands[i].host - traceStart) * 1e9 - stamps[0];
+      int d = commands[i].device;
+      offset[d] = fmin(offset[d], gap);
+    }
+  }
+
+  if (file) {
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, "
+                  "\"args\": {\"name\": \"host\"}}");
+    for (int d = 0; d < numDevices; d++) {
+      fprintf(file,
+              ",\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+              "\"args\": {\"name\": \"%s\"}}",
+              d + 1, deviceNames[d]);
+    }
+    for (int q = 0; q < numQueues; q++) {
+      for (int i = 0; i < numCommands; i++) {
+        if (commands[i].queue == q) {
+          fprintf(file,
+                  ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                  "\"tid\": %d, \"args\": {\"name\": \"queue %d\"}}",
+                  commands[i].device + 1, q, q);
+          break;
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < numCommands; i++) {
+    int profiled = 1;
+    for (int s = 0; s < 4; s++) {
+      profiled &= clGetEventProfilingInfo(commands[i].event, info[s],
+                                          sizeof(cl_ulong), &stamps[s],
+                                          NULL) == CL_SUCCESS;
+    }
+    if (file && profiled) {
+      double base = offset[commands[i].device];
+      fprintf(file,
+              ",\n{\"name\": \"%s\", \"cat\": \"opencl\", \"ph\": \"X\", "
+              "\"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+              "\"args\": {\"queued_us\": %.3f, \"submit_us\": %.3f, "
+              "\"queued_to_start_us\": %.3f}}",
+              commands[i].name, commands[i].device + 1, commands[i].queue,
+              (stamps[2] + base) / 1e3,
+              (stamps[3] - stamps[2]) / 1e3, (stamps[0] + base) / 1e3,
+              (stamps[1] + base) / 1e3, (stamps[2] - stamps[0]) / 1e3);
+    }
+    clReleaseEvent(commands[i].event);
+  }
+  for (int i = 0; file && i < numSpans; i++) {
+    fprintf(file,
+            ",\n{\"name\": \"%s\", \"cat\": \"host\", \"ph\": \"X\", "
+            "\"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+            spans[i].name, spans[i].thread,
+            (spans[i].start - traceStart) * 1e6,
+            (spans[i].end - spans[i].start) * 1e6);
+  }
+  if (file) {
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    fprintf(stderr, "trace of %d commands & %d spans written to %s\n",
+            numCommands, numSpans, tracePath);
+  }
+
+  free(commands);
+  free(spans);
+  commands = NULL;
+  spans = NULL;
+  numCommands = commandSpace = numSpans = spanSpace = 0;
+  numDevices = numQueues = 0;
+  pthread_mutex_unlock(&traceLock);
+}
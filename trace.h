@@ -0,0 +1,66 @@
+// opt-in Chrome trace-event export of OpenCL commands & host spans. with
+// CLMM_TRACE set to a file name, every traced command's queued, submit,
+// start & end times and every host span are written there at exit, for
+// ui.perfetto.dev or chrome://tracing. unset, each hook is one predictable
+// branch on traceState.
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "timer.h"
+#include <CL/opencl.h>
+
+#define TRACE_ENV "CLMM_TRACE" // file the trace is written to
+#define TRACE_NAME 64          // longest command or span name kept
+
+extern int traceState; // -1 until CLMM_TRACE is read, then 0 off or 1 on
+
+int traceSetup(void);
+void traceRecord(cl_event event, const char *name, int retain);
+void traceRecordLaunch(cl_event event, cl_kernel kernel);
+void traceSpan(const char *name, double start);
+void traceFlush(void);
+
+static inline int tracing(void) {
+  return traceState > 0 || (traceState < 0 && traceSetup());
+}
+
+// where to put the event of a command that is only wanted for the trace:
+// out when tracing, otherwise NULL so no event is made
+static inline cl_event *traceEvent(cl_event *out) {
+  *out = NULL;
+  return tracing() ? out : NULL;
+}
+
+// a command the caller keeps its own reference to. a NULL name is filled in
+// from the command type when the trace is written.
+static inline void traceCommand(cl_event event, const char *name) {
+  if (tracing() && event) {
+    traceRecord(event, name, 1);
+  }
+}
+
+// a command from traceEvent: the trace takes over its only reference
+static inline void traceTake(cl_event event, const char *name) {
+  if (event) {
+    traceRecord(event, name, 0);
+  }
+}
+
+// a kernel launch, named after the kernel's function
+static inline void traceLaunch(cl_event event, cl_kernel kernel) {
+  if (tracing() && event) {
+    traceRecordLaunch(event, kernel);
+  }
+}
+
+// host spans: start = traceBegin() ... traceEnd(name, start)
+static inline double traceBegin(void) { return tracing() ? wallTime() : 0.0; }
+
+static inline void traceEnd(const char *name, double start) {
+  if (tracing()) {
+    traceSpan(name, start);
+  }
+}
+
+#endif
@@ -0,0 +1,291 @@
+#include "transfer.h"
+#include "bench.h"
+#include "hostAlloc.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  cl_command_queue queues[2]; // bidirectional traffic uses both
+  cl_mem device[2];           // write into the first, read out of the second
+  cl_mem pinned[2];           // CL_MEM_ALLOC_HOST_PTR staging buffers
+  char *pinnedHost[2];        // ... mapped for the whole run
+  char *host[2];              // pageable, from hostAlloc
+} transferBuffers;
+
+static const char *transferNames[TRANSFERS] = {
+    "write", "pin wr", "map wr", "rect wr", "read",     "pin rd",
+    "map rd", "rect rd", "d2d",  "bidir",   "pin bidir"};
+
+// rows of the rect copies: TRANSFER_ROW bytes each, or two rows of half the
+// buffer when it is smaller. every other row of the host panel is moved.
+static void rectShape(size_t bytes, size_t *row, size_t *rows) {
+  *row = bytes >= 2 * TRANSFER_ROW ? TRANSFER_ROW : bytes / 2;
+  *rows = bytes / (2 * *row);
+}
+
+// one transfer of a bytes buffer, timed on the host from enqueue to done.
+// moved is what crossed the bus: half the buffer for rect, twice for bidir.
+static cl_int transferOnce(transferBuffers *b, transferKind kind,
+                           size_t bytes, double *seconds, size_t *moved) {
+  cl_command_queue q = b->queues[0];
+  const size_t origin[3] = {0, 0, 0};
+  size_t row, rows;
+  rectShape(bytes, &row, &rows);
+  size_t region[3] = {row, rows, 1};
+  cl_int err = CL_SUCCESS;
+  void *mapped;
+  *moved = bytes;
+
+  double start = wallTime();
+  switch (kind) {
+  case TRANSFER_WRITE:
+    err = writeBuffer(b->device[0], (const double *)b->host[0], bytes, &q);
+    break;
+  case TRANSFER_PIN_WRITE:
+    err = clEnqueueWriteBuffer(q, b->device[0], CL_TRUE, 0, bytes,
+                               b->pinnedHost[0], 0, NULL, NULL);
+    break;
+  case TRANSFER_MAP_WRITE:
+    mapped = clEnqueueMapBuffer(q, b->device[0], CL_TRUE,
+                                CL_MAP_WRITE_INVALIDATE_REGION, 0, bytes, 0,
+                                NULL, NULL, &err);
+    if (!err) {
+      memcpy(mapped, b->host[0], bytes);
+      err = clEnqueueUnmapMemObject(q, b->device[0], mapped, 0, NULL, NULL);
+    }
+    break;
+  case TRANSFER_RECT_WRITE:
+    err = clEnqueueWriteBufferRect(q, b->device[0], CL_TRUE, origin, origin,
+                                   region, row, 0, 2 * row, 0, b->host[0], 0,
+                                   NULL, NULL);
+    *moved = row * rows;
+    break;
+  case TRANSFER_READ:
+    err = readBuffer(b->device[1], (double *)b->host[1], bytes, &q);
+    break;
+  case TRANSFER_PIN_READ:
+    err = clEnqueueReadBuffer(q, b->device[1], CL_TRUE, 0, bytes,
+                              b->pinnedHost[1], 0, NULL, NULL);
+    break;
+  case TRANSFER_MAP_READ:
+    mapped = clEnqueueMapBuffer(q, b->device[1], CL_TRUE, CL_MAP_READ, 0,
+                                bytes, 0, NULL, NULL, &err);
+    if (!err) {
+      memcpy(b->host[1], mapped, bytes);
+      err = clEnqueueUnmapMemObject(q, b->device[1], mapped, 0, NULL, NULL);
+    }
+    break;
+  case TRANSFER_RECT_READ:
+    err = clEnqueueReadBufferRect(q, b->device[1], CL_TRUE, origin, origin,
+                                  region, row, 0, 2 * row, 0, b->host[1], 0,
+                                  NULL, NULL);
+    *moved = row * rows;
+    break;
+  case TRANSFER_COPY:
+    err = clEnqueueCopyBuffer(q, b->device[0], b->device[1], 0, 0, bytes, 0,
+                              NULL, NULL);
+    break;
+  case TRANSFER_BIDIR:
+  case TRANSFER_PIN_BIDIR: {
+    char **from = kind == TRANSFER_BIDIR ? b->host : b->pinnedHost;
+    if (!(err = clEnqueueWriteBuffer(b->queues[0], b->device[0], CL_FALSE, 0,
+                                     bytes, from[0], 0, NULL, NULL))) {
+      err = clEnqueueReadBuffer(b->queues[1], b->device[1], CL_FALSE, 0,
+                                bytes, from[1], 0, NULL, NULL);
+    }
+    *moved = 2 * bytes;
+    break;
+  }
+  default:
+    break;
+  }
+  if (!err && (err = clFinish(b->queues[0])) == CL_SUCCESS) {
+    err = clFinish(b->queues[1]);
+  }
+  *seconds = wallTime() - start;
+  return checkErr(err, transferNames[kind]);
+}
+
+// largest size the device takes for the four device-side buffers; pinned
+// ones may live in host memory but are counted too
+static size_t deviceCap(cl_device_id device, size_t maxBytes) {
+  cl_ulong globalMem, maxAlloc;
+  clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem),
+                  &globalMem, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc),
+                  &maxAlloc, NULL);
+  while (maxBytes > TRANSFER_MIN &&
+         (maxBytes > maxAlloc || 4 * (cl_ulong)maxBytes > globalMem)) {
+    maxBytes /= 2;
+  }
+  return maxBytes;
+}
+
+static cl_int createBuffers(runtime *rt, transferBuffers *b, size_t bytes) {
+  cl_int err = CL_SUCCESS;
+  memset(b, 0, sizeof(*b));
+  b->queues[0] = rt->queues[0];
+  b->queues[1] = rt->queues[1];
+  for (int i = 0; i < 2 && !err; i++) {
+    b->host[i] = (char *)hostAlloc(bytes);
+    if (!b->host[i]) {
+      fprintf(stderr, "not enough host memory for %zu bytes\n", bytes);
+      return CL_OUT_OF_HOST_MEMORY;
+    }
+    memset(b->host[i], i + 1, bytes); // fault the pages in before timing
+    if ((err = createBuffer(&b->device[i], bytes, CL_MEM_READ_WRITE,
+                            &rt->context)) ||
+        (err = createBuffer(&b->pinned[i], bytes,
+                            CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                            &rt->context))) {
+      break;
+    }
+    b->pinnedHost[i] = (char *)clEnqueueMapBuffer(
+        rt->queues[0], b->pinned[i], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+        bytes, 0, NULL, NULL, &err);
+    if (checkErr(err, "mapped pinned buffer")) {
+      b->pinnedHost[i] = NULL;
+      break;
+    }
+    memset(b->pinnedHost[i], i + 1, bytes);
+  }
+  return err;
+}
+
+static void releaseBuffers(transferBuffers *b) {
+  for (int i = 0; i < 2; i++) {
+    if (b->pinnedHost[i]) {
+      clEnqueueUnmapMemObject(b->queues[0], b->pinned[i], b->pinnedHost[i],
+                              0, NULL, NULL);
+    }
+  }
+  if (b->queues[0]) {
+    clFinish(b->queues[0]);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (b->pinned[i]) {
+      clReleaseMemObject(b->pinned[i]);
+    }
+    if (b->device[i]) {
+      clReleaseMemObject(b->device[i]);
+    }
+    hostFree(b->host[i]);
+  }
+}
+
+static void printSize(size_t bytes) {
+  if (bytes >= 1 << 30) {
+    printf("%6zuG", bytes >> 30);
+  } else if (bytes >= 1 << 20) {
+    printf("%6zuM", bytes >> 20);
+  } else {
+    printf("%6zuK", bytes >> 10);
+  }
+}
+
+static void printHeader(const char *title) {
+  printf("%s\n%7s", title, "size");
+  for (int k = 0; k < TRANSFERS; k++) {
+    printf(" %9s", transferNames[k]);
+  }
+  printf("\n");
+}
+
+// sweeps every power of two size from minBytes to maxBytes through every
+// transfer kind. reps 0 picks enough repetitions to move TRANSFER_BYTES per
+// size. prints median GB/s & median latency tables; with outPath, one CSV
+// line per size & kind as well, for plotting the curves.
+cl_int runTransfer(runtime *rt, size_t minBytes, size_t maxBytes, int reps,
+                   const char *outPath) {
+  maxBytes = deviceCap(rt->deviceID, maxBytes);
+  if (minBytes < 8 || minBytes > maxBytes) {
+    fprintf(stderr, "no sizes between %zu and %zu bytes\n", minBytes,
+            maxBytes);
+    return CL_INVALID_VALUE;
+  }
+  int numSizes = 0;
+  for (size_t s = minBytes; s <= maxBytes; s *= 2) {
+    numSizes++;
+  }
+  double *gbps = (double *)calloc((size_t)numSizes * TRANSFERS, sizeof(double));
+  double *micros =
+      (double *)calloc((size_t)numSizes * TRANSFERS, sizeof(double));
+  double *samples = (double *)malloc(TRANSFER_REPS_MAX * sizeof(double));
+  FILE *out = outPath ? fopen(outPath, "w") : NULL;
+  if (outPath && !out) {
+    fprintf(stderr, "cannot write %s\n", outPath);
+  }
+  if (out) {
+    fprintf(out, "bytes,kind,moved,reps,median_us,min_us,gbps\n");
+  }
+
+  transferBuffers b;
+  cl_int err = gbps && micros && samples ? createBuffers(rt, &b, maxBytes)
+                                         : CL_OUT_OF_HOST_MEMORY;
+  char name[256];
+  clGetDeviceInfo(rt->deviceID, CL_DEVICE_NAME, sizeof(name), name, NULL);
+  printf("transfers to & from %s, %zu bytes to %zu\n", name, minBytes,
+         maxBytes);
+
+  int s = 0;
+  for (size_t bytes = minBytes; !err && bytes <= maxBytes; bytes *= 2, s++) {
+    int count = reps > 0 ? reps : (int)(TRANSFER_BYTES / bytes);
+    count = count < TRANSFER_REPS_MIN   ? TRANSFER_REPS_MIN
+            : count > TRANSFER_REPS_MAX ? TRANSFER_REPS_MAX
+                                        : count;
+    for (int k = 0; k < TRANSFERS && !err; k++) {
+      size_t moved = bytes;
+      // one untimed run first, so first-touch & mapping costs are left out
+      for (int r = -1; r < count && !err; r++) {
+        double seconds;
+        err = transferOnce(&b, (transferKind)k, bytes, &seconds, &moved);
+        if (r >= 0) {
+          samples[r] = seconds;
+        }
+      }
+      if (err) {
+        break;
+      }
+      benchStats stats;
+      benchSummarize(samples, count, &stats);
+      gbps[s * TRANSFERS + k] = moved / stats.median * 1e-9;
+      micros[s * TRANSFERS + k] = stats.median * 1e6;
+      if (out) {
+        fprintf(out, "%zu,%s,%zu,%d,%.3f,%.3f,%.4f\n", bytes,
+                transferNames[k], moved, count, stats.median * 1e6,
+                stats.min * 1e6, gbps[s * TRANSFERS + k]);
+      }
+    }
+  }
+
+  // tables of the sizes that completed
+  printHeader("GB/s, at the median time");
+  for (int i = 0; i < s; i++) {
+    printSize(minBytes << i);
+    for (int k = 0; k < TRANSFERS; k++) {
+      printf(" %9.2f", gbps[i * TRANSFERS + k]);
+    }
+    printf("\n");
+  }
+  printHeader("median latency, us");
+  for (int i = 0; i < s; i++) {
+    printSize(minBytes << i);
+    for (int k = 0; k < TRANSFERS; k++) {
+      printf(" %9.1f", micros[i * TRANSFERS + k]);
+    }
+    printf("\n");
+  }
+
+  if (gbps && micros && samples) {
+    releaseBuffers(&b);
+  }
+  if (out) {
+    fclose(out);
+  }
+  free(gbps);
+  free(micros);
+  free(samples);
+  return err;
+}
@@ -0,0 +1,35 @@
+// host <-> device transfer bandwidth & latency of the runtime's device, over
+// buffer sizes, for every way clHelper & libclmatmul could move the data
+
+#ifndef TRANSFER_H_
+#define TRANSFER_H_
+
+#include "runtime.h"
+
+#define TRANSFER_MIN (4 << 10)   // smallest buffer swept, 4 KiB
+#define TRANSFER_MAX (1 << 30)   // largest, capped by the device's memory
+#define TRANSFER_BYTES (1 << 30) // bytes each size moves over its reps
+#define TRANSFER_REPS_MIN 3
+#define TRANSFER_REPS_MAX 100
+#define TRANSFER_ROW 1024 // bytes per row of the rect copies
+
+// ways of moving one buffer, in the order the tables print them
+typedef enum {
+  TRANSFER_WRITE,     // clEnqueueWriteBuffer from pageable memory
+  TRANSFER_PIN_WRITE, // the same from a mapped CL_MEM_ALLOC_HOST_PTR buffer
+  TRANSFER_MAP_WRITE, // map the device buffer, memcpy in, unmap
+  TRANSFER_RECT_WRITE, // every other row of a host panel, WriteBufferRect
+  TRANSFER_READ,
+  TRANSFER_PIN_READ,
+  TRANSFER_MAP_READ,
+  TRANSFER_RECT_READ,
+  TRANSFER_COPY,      // device buffer to device buffer
+  TRANSFER_BIDIR,     // pageable write & read at once, on two queues
+  TRANSFER_PIN_BIDIR, // pinned write & read at once
+  TRANSFERS
+} transferKind;
+
+cl_int runTransfer(runtime *rt, size_t minBytes, size_t maxBytes, int reps,
+                   const char *outPath);
+
+#endif
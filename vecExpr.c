@@ -0,0 +1,316 @@
+#include "vecExpr.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// functions an expression may call; all exist in OpenCL C and libm
+static const struct {
+  const char *name;
+  int arity;
+} functions[] = {{"sqrt", 1}, {"fabs", 1}, {"exp", 1},  {"log", 1},
+                 {"sin", 1},  {"cos", 1},  {"pow", 2},  {"fmin", 2},
+                 {"fmax", 2}, {"fma", 3}};
+#define NUM_FUNCTIONS (int)(sizeof(functions) / sizeof(functions[0]))
+
+// recursive descent state
+typedef struct {
+  expr *e;
+  const char *text;
+  const char *at;
+  int failed;
+} parser;
+
+static int fail(parser *p, const char *why) {
+  if (!p->failed) {
+    fprintf(stderr, "expression error at column %d: %s\n",
+            (int)(p->at - p->text) + 1, why);
+  }
+  p->failed = 1;
+  return -1;
+}
+
+static void skipSpace(parser *p) {
+  while (isspace((unsigned char)*p->at)) {
+    p->at++;
+  }
+}
+
+static int addNode(parser *p, char op, int a, int b, int c) {
+  if (p->e->numNodes == EXPR_MAX_NODES) {
+    return fail(p, "expression too long");
+  }
+  exprNode *node = &p->e->nodes[p->e->numNodes];
+  node->op = op;
+  node->value = 0.0;
+  node->index = 0;
+  node->args[0] = a;
+  node->args[1] = b;
+  node->args[2] = c;
+  return p->e->numNodes++;
+}
+
+static int parseSum(parser *p);
+
+// number | input | function(args) | (sum)
+static int parsePrimary(parser *p) {
+  skipSpace(p);
+  if (isdigit((unsigned char)*p->at) || *p->at == '.') {
+    char *end;
+    double value = strtod(p->at, &end);
+    if (end == p->at) {
+      return fail(p, "bad number");
+    }
+    p->at = end;
+    int node = addNode(p, 'n', -1, -1, -1);
+    if (node >= 0) {
+      p->e->nodes[node].value = value;
+    }
+    return node;
+  }
+  if (*p->at == '(') {
+    p->at++;
+    int node = parseSum(p);
+    skipSpace(p);
+    if (*p->at != ')') {
+      return fail(p, "expected )");
+    }
+    p->at++;
+    return node;
+  }
+  if (isalpha((unsigned char)*p->at)) {
+    const char *start = p->at;
+    while (isalnum((unsigned char)*p->at)) {
+      p->at++;
+    }
+    size_t length = p->at - start;
+    if (length == 1 && *start >= 'A' && *start < 'A' + EXPR_MAX_INPUTS) {
+      int node = addNode(p, 'v', -1, -1, -1);
+      if (node >= 0) {
+        p->e->nodes[node].index = *start - 'A';
+        p->e->inputs |= 1u << (*start - 'A');
+      }
+      return node;
+    }
+    for (int f = 0; f < NUM_FUNCTIONS; f++) {
+      if (strlen(functions[f].name) != length ||
+          strncmp(functions[f].name, start, length)) {
+        continue;
+      }
+      int args[3] = {-1, -1, -1};
+      skipSpace(p);
+      if (*p->at != '(') {
+        return fail(p, "expected ( after function name");
+      }
+      p->at++;
+      for (int a = 0; a < functions[f].arity; a++) {
+        if (a > 0) {
+          skipSpace(p);
+          if (*p->at != ',') {
+            return fail(p, "too few function arguments");
+          }
+          p->at++;
+        }
+        args[a] = parseSum(p);
+      }
+      skipSpace(p);
+      if (*p->at != ')') {
+        return fail(p, "expected ) after function arguments");
+      }
+      p->at++;
+      int node = addNode(p, 'f', args[0], args[1], args[2]);
+      if (node >= 0) {
+        p->e->nodes[node].index = f;
+      }
+      return node;
+    }
+    p->at = start;
+    return fail(p, "unknown name; inputs are A-H");
+  }
+  return fail(p, "expected a number, input, function or (");
+}
+
+// -unary | +unary | primary
+static int parseUnary(parser *p) {
+  skipSpace(p);
+  if (*p->at == '-') {
+    p->at++;
+    return addNode(p, 'u', parseUnary(p), -1, -1);
+  }
+  if (*p->at == '+') {
+    p->at++;
+    return parseUnary(p);
+  }
+  return parsePrimary(p);
+}
+
+// unary (* or / unary)*
+static int parseProduct(parser *p) {
+  int left = parseUnary(p);
+  for (skipSpace(p); !p->failed && (*p->at == '*' || *p->at == '/');
+       skipSpace(p)) {
+    char op = *p->at++;
+    left = addNode(p, op, left, parseUnary(p), -1);
+  }
+  return left;
+}
+
+// product (+ or - product)*
+static int parseSum(parser *p) {
+  int left = parseProduct(p);
+  for (skipSpace(p); !p->failed && (*p->at == '+' || *p->at == '-');
+       skipSpace(p)) {
+    char op = *p->at++;
+    left = addNode(p, op, left, parseProduct(p), -1);
+  }
+  return left;
+}
+
+// parse an expression such as "A*B+C*2.0". only inputs, numbers, + - * /,
+// parentheses and the functions above are accepted, so nothing else can end
+// up in the generated kernel. returns 0, or -1 after reporting the error.
+int exprParse(expr *e, const char *text) {
+  parser p = {e, text, text, 0};
+  e->numNodes = 0;
+  e->inputs = 0;
+  e->root = parseSum(&p);
+  skipSpace(&p);
+  if (!p.failed && *p.at) {
+    fail(&p, "unexpected character");
+  }
+  if (!p.failed && e->inputs == 0) {
+    fail(&p, "expression uses no input");
+  }
+  return p.failed ? -1 : 0;
+}
+
+// append to a bounded string, keeping track of the length it would need
+static void append(char *source, size_t size, size_t *length,
+                   const char *text) {
+  size_t n = strlen(text);
+  if (*length + n < size) {
+    memcpy(source + *length, text, n + 1);
+  }
+  *length += n;
+}
+
+static void emitNode(const expr *e, int node, char *source, size_t size,
+                     size_t *length) {
+  const exprNode *x = &e->nodes[node];
+  char text[40];
+  switch (x->op) {
+  case 'n':
+    // always a double literal, so 1/2 is not integer division
+    snprintf(text, sizeof(text), "%.17g", x->value);
+    if (!strpbrk(text, ".eEin")) {
+      strcat(text, ".0");
+    }
+    append(source, size, length, text);
+    break;
+  case 'v':
+    snprintf(text, sizeof(text), "%c[i]", 'A' + x->index);
+    append(source, size, length, text);
+    break;
+  case 'u':
+    append(source, size, length, "(-");
+    emitNode(e, x->args[0], source, size, length);
+    append(source, size, length, ")");
+    break;
+  case 'f':
+    append(source, size, length, functions[x->index].name);
+    append(source, size, length, "(");
+    for (int a = 0; a < functions[x->index].arity; a++) {
+      if (a > 0) {
+        append(source, size, length, ", ");
+      }
+      emitNode(e, x->args[a], source, size, length);
+    }
+    append(source, size, length, ")");
+    break;
+  default:
+    snprintf(text, sizeof(text), " %c ", x->op);
+    append(source, size, length, "(");
+    emitNode(e, x->args[0], source, size, length);
+    append(source, size, length, text);
+    emitNode(e, x->args[1], source, size, length);
+    append(source, size, length, ")");
+  }
+}
+
+// OpenCL source of the fused kernel:
+//   fused(ulong n, double *OUT, double *<each input used, in order>)
+// returns the length of the source; it only fits if that is below size.
+size_t exprKernelSource(const expr *e, char *source, size_t size) {
+  size_t length = 0;
+  char text[64];
+  if (size > 0) {
+    source[0] = '\0';
+  }
+  append(source, size, &length,
+         "__kernel void " EXPR_KERNEL "(const ulong n, __global double *OUT");
+  for (int v = 0; v < EXPR_MAX_INPUTS; v++) {
+    if (e->inputs & (1u << v)) {
+      snprintf(text, sizeof(text), ",\n    __global const double *%c",
+               'A' + v);
+      append(source, size, &length, text);
+    }
+  }
+  append(source, size, &length,
+         ") {\n  const size_t i = get_global_id(0);\n  if (i < n) {\n"
+         "    OUT[i] = ");
+  emitNode(e, e->root, source, size, &length);
+  append(source, size, &length, ";\n  }\n}\n");
+  return length;
+}
+
+static double evalNode(const expr *e, int node, double *const *inputs,
+                       size_t i) {
+  const exprNode *x = &e->nodes[node];
+  double a = x->args[0] >= 0 ? evalNode(e, x->args[0], inputs, i) : 0.0;
+  double b = x->args[1] >= 0 ? evalNode(e, x->args[1], inputs, i) : 0.0;
+  double c = x->args[2] >= 0 ? evalNode(e, x->args[2], inputs, i) : 0.0;
+  switch (x->op) {
+  case 'n':
+    return x->value;
+  case 'v':
+    return inputs[x->index][i];
+  case 'u':
+    return -a;
+  case '+':
+    return a + b;
+  case '-':
+    return a - b;
+  case '*':
+    return a * b;
+  case '/':
+    return a / b;
+  }
+  switch (x->index) {
+  case 0:
+    return sqrt(a);
+  case 1:
+    return fabs(a);
+  case 2:
+    return exp(a);
+  case 3:
+    return log(a);
+  case 4:
+    return sin(a);
+  case 5:
+    return cos(a);
+  case 6:
+    return pow(a, b);
+  case 7:
+    return fmin(a, b);
+  case 8:
+    return fmax(a, b);
+  default:
+    return fma(a, b, c);
+  }
+}
+
+// element i of the expression on the host; inputs is indexed by letter
+double exprEval(const expr *e, double *const *inputs, size_t i) {
+  return evalNode(e, e->root, inputs, i);
+}
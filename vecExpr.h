@@ -0,0 +1,33 @@
+// elementwise expressions over input vectors A..H, compiled into one fused
+// OpenCL kernel
+
+#ifndef VECEXPR_H_
+#define VECEXPR_H_
+
+#include <stddef.h>
+
+#define EXPR_MAX_INPUTS 8  // inputs are named A..H
+#define EXPR_MAX_NODES 256 // parsed terms in one expression
+#define EXPR_KERNEL "fused"
+
+typedef struct {
+  char op;        // 'n' number, 'v' input, 'f' function, 'u' negate, + - * /
+  double value;   // number
+  int index;      // input or function
+  int args[3];    // child nodes
+} exprNode;
+
+typedef struct {
+  exprNode nodes[EXPR_MAX_NODES];
+  int numNodes;
+  int root;
+  unsigned inputs; // bit i set when input 'A' + i is used
+} expr;
+
+int exprParse(expr *e, const char *text);
+
+size_t exprKernelSource(const expr *e, char *source, size_t size);
+
+double exprEval(const expr *e, double *const *inputs, size_t i);
+
+#endif
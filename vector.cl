@@ -1,14 +1,86 @@
 //Basic Vector Addition A[n] + B[n] = C[n]
 //Alex Chacko
 
-__kernel void add(__global const double *A, __global const double *B, __global double *C){
+__kernel void add(__global const double *A, __global const double *B, __global double *C, const ulong n){
 	//index of element
-	int i = get_global_id(0);
-	C[i] = A[i] + B[i];
+	size_t i = get_global_id(0);
+	//the global size is rounded up to a whole work-group
+	if (i < n){
+		C[i] = A[i] + B[i];
+	}
 }
 
-__kernel void mult(__global const double *A, __global const double *B, __global double *C){
+__kernel void mult(__global const double *A, __global const double *B, __global double *C, const ulong n){
 	//index of element
-	int i = get_global_id(0);
-	C[i] = A[i] * B[i];
-}
\ No newline at end of file
+	size_t i = get_global_id(0);
+	if (i < n){
+		C[i] = A[i] * B[i];
+	}
+}
+
+#define ADD(a, b) ((a) + (b))
+#define MULT(a, b) ((a) * (b))
+
+//W doubles per load: a fixed grid of work-items strides over the n / W whole
+//vectors, then the first n % W work-items take one leftover element each
+#define GRID_STRIDE(NAME, OP, W) \
+__kernel void NAME(__global const double *A, __global const double *B, __global double *C, const ulong n){ \
+	const size_t whole = n / W; \
+	for (size_t i = get_global_id(0); i < whole; i += get_global_size(0)){ \
+		vstore##W(OP(vload##W(i, A), vload##W(i, B)), i, C); \
+	} \
+	size_t tail = whole * W + get_global_id(0); \
+	if (tail < n){ \
+		C[tail] = OP(A[tail], B[tail]); \
+	} \
+}
+
+GRID_STRIDE(add4, ADD, 4)
+GRID_STRIDE(add8, ADD, 8)
+GRID_STRIDE(mult4, MULT, 4)
+GRID_STRIDE(mult8, MULT, 8)
+
+//STREAM copy, scale & triad; add is above. s is the scalar of scale & triad
+__kernel void copy(__global const double *A, __global const double *B, __global double *C, const ulong n){
+	size_t i = get_global_id(0);
+	if (i < n){
+		C[i] = A[i];
+	}
+}
+
+__kernel void scale(__global const double *A, __global const double *B, __global double *C, const ulong n, const double s){
+	size_t i = get_global_id(0);
+	if (i < n){
+		C[i] = s * A[i];
+	}
+}
+
+__kernel void triad(__global const double *A, __global const double *B, __global double *C, const ulong n, const double s){
+	size_t i = get_global_id(0);
+	if (i < n){
+		C[i] = A[i] + s * B[i];
+	}
+}
+
+//Z = alpha * X op Y over a rows x cols view of each operand. element (r, c)
+//of an operand is at off + r * rowStride + c * colStride, so a stride of 0
+//broadcasts it: a row vector over every row, a column over every column or
+//one scalar over everything. op 0 adds, 1 multiplies, 2 scales X alone.
+//Launched with exactly rows x cols work-items.
+__kernel void strided(const int op, const double alpha,
+		__global const double *X, const ulong xOff, const long xRow, const long xCol,
+		__global const double *Y, const ulong yOff, const long yRow, const long yCol,
+		__global double *Z, const ulong zOff, const long zRow, const long zCol){
+	long r = get_global_id(0);
+	long c = get_global_id(1);
+	double x = alpha * X[xOff + r * xRow + c * xCol];
+	double z;
+	if (op == 0){
+		z = x + Y[yOff + r * yRow + c * yCol];
+	} else if (op == 1){
+		z = x * Y[yOff + r * yRow + c * yCol];
+	} else {
+		z = x;
+	}
+	Z[zOff + r * zRow + c * zCol] = z;
+}
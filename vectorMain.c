@@ -1,42 +1,65 @@
 #define CL_TARGET_OPENCL_VERSION 200
 
-#include <CL/opencl.h>
+#include "cpuVector.h"
+#include "deviceSelect.h"
+#include "hostAlloc.h"
+#include "hwCounters.h"
+#include "parallel.h"
+#include "philox.h"
+#include "reduce.h"
+#include "runtime.h"
+#include "scan.h"
+#include "strided.h"
+#include "timer.h"
+#include "trace.h"
+#include "vecExpr.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#define VECTOR_N (1 << 27) // default length of vector 134,217,728
+#define RING 3 // chunks in flight when streaming: up, compute & down
+#define REDUCE_REPS 5 // timed repetitions of each reduction, best is kept
+#define REDUCE_TOL_DOUBLE 1e-9 // largest relative error of a double reduction
+#define REDUCE_TOL_FLOAT 1e-3  // ... of a float one, summed in float
+#define GROUPS_PER_CU 8 // work-groups per compute unit for grid-stride kernels
+#define KERNEL_REPS 5   // timed runs of each kernel in --compare, best is kept
+#define STREAM_SCALAR 3.0 // s in the STREAM scale & triad kernels
+#define SCAN_SWEEP_MIN (1 << 10) // smallest length in the --scan sweep
+#define PAGE_WALK_STRIDE 4099  // pages between reads of the --pages walk
 
-#define N (1 << 27) // length of vector 134,217,728
-#define MAX_SOURCE_SIZE (0x100000)
-
-void vectorAddition(double *A, double *B, double *C) {
-  for (int i = 0; i < N; i++) {
-    C[i] = A[i] + B[i];
-  }
+// C = A + B across every host thread
+void vectorAddition(double *A, double *B, double *C, size_t n) {
+  cpuVectorOp(VECTOR_ADD, C, A, B, 0.0, n, defaultThreads());
 }
 
-void cpuBench(double *A, double *B) {
-  double *testC = (double *)malloc(N * sizeof(double));
-
-  clock_t start = clock();
-  vectorAddition(A, B, testC);
-  clock_t end = clock();
+void vectorCpuBench(double *A, double *B, size_t n) {
+  double *testC = (double *)hostAlloc(n * sizeof(double));
 
-  double cpuTime = (double)(end - start) / (CLOCKS_PER_SEC);
+  // wall time; clock() would add up the CPU time of every thread
+  hwCounters counters;
+  countersStart(&counters);
+  double start = wallTime();
+  vectorAddition(A, B, testC, n);
+  double cpuTime = wallTime() - start;
+  countersStop(&counters);
   // verify answer
-  for (int i = 0; i < N; i++) {
+  for (size_t i = 0; i < n; i++) {
     if (testC[i] != (A[i] + B[i])) {
       printf("A%f + B%f = C%f\n", A[i], B[i], testC[i]);
       break;
     }
   }
   printf("CPU values correct. Time taken: %0.3f seconds\n", cpuTime);
-  free(testC);
+  countersReport(&counters, "cpu", (double)n);
+  hostFree(testC);
 }
 
-void gpuBench(double *A, double *B, double *C, double nanoseconds) {
-  for (int i = 0; i < N; i++) {
+void vectorGpuBench(double *A, double *B, double *C, size_t n,
+                    double nanoseconds) {
+  for (size_t i = 0; i < n; i++) {
     if (fabs(C[i] - (A[i] + B[i])) > 0.001) {
       printf("A%f + B%f = C%f\n", A[i], B[i], C[i]);
       break;
@@ -46,300 +69,914 @@ void gpuBench(double *A, double *B, double *C, double nanoseconds) {
          "results: \n",
          nanoseconds / 1000000.0);
   for (int j = 0; j < 5; j++) {
-    int element = rand() % (N + 1);
-    printf("%d: %f + %f = %f\n", element, A[element], B[element], C[element]);
+    size_t element = rand() % n;
+    printf("%zu: %f + %f = %f\n", element, A[element], B[element], C[element]);
   }
 }
 
-const char *getErrorString(cl_int error) {
-  switch (error) {
-  // run-time and JIT compiler errors
-  case 0:
-    return "CL_SUCCESS";
-  case -1:
-    return "CL_DEVICE_NOT_FOUND";
-  case -2:
-    return "CL_DEVICE_NOT_AVAILABLE";
-  case -3:
-    return "CL_COMPILER_NOT_AVAILABLE";
-  case -4:
-    return "CL_MEM_OBJECT_ALLOCATION_FAILURE";
-  case -5:
-    return "CL_OUT_OF_RESOURCES";
-  case -6:
-    return "CL_OUT_OF_HOST_MEMORY";
-  case -7:
-    return "CL_PROFILING_INFO_NOT_AVAILABLE";
-  case -8:
-    return "CL_MEM_COPY_OVERLAP";
-  case -9:
-    return "CL_IMAGE_FORMAT_MISMATCH";
-  case -10:
-    return "CL_IMAGE_FORMAT_NOT_SUPPORTED";
-  case -11:
-    return "CL_BUILD_PROGRAM_FAILURE";
-  case -12:
-    return "CL_MAP_FAILURE";
-  case -13:
-    return "CL_MISALIGNED_SUB_BUFFER_OFFSET";
-  case -14:
-    return "CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST";
-  case -15:
-    return "CL_COMPILE_PROGRAM_FAILURE";
-  case -16:
-    return "CL_LINKER_NOT_AVAILABLE";
-  case -17:
-    return "CL_LINK_PROGRAM_FAILURE";
-  case -18:
-    return "CL_DEVICE_PARTITION_FAILED";
-  case -19:
-    return "CL_KERNEL_ARG_INFO_NOT_AVAILABLE";
-
-  // compile-time errors
-  case -30:
-    return "CL_INVALID_VALUE";
-  case -31:
-    return "CL_INVALID_DEVICE_TYPE";
-  case -32:
-    return "CL_INVALID_PLATFORM";
-  case -33:
-    return "CL_INVALID_DEVICE";
-  case -34:
-    return "CL_INVALID_CONTEXT";
-  case -35:
-    return "CL_INVALID_QUEUE_PROPERTIES";
-  case -36:
-    return "CL_INVALID_COMMAND_QUEUE";
-  case -37:
-    return "CL_INVALID_HOST_PTR";
-  case -38:
-    return "CL_INVALID_MEM_OBJECT";
-  case -39:
-    return "CL_INVALID_IMAGE_FORMAT_DESCRIPTOR";
-  case -40:
-    return "CL_INVALID_IMAGE_SIZE";
-  case -41:
-    return "CL_INVALID_SAMPLER";
-  case -42:
-    return "CL_INVALID_BINARY";
-  case -43:
-    return "CL_INVALID_BUILD_OPTIONS";
-  case -44:
-    return "CL_INVALID_PROGRAM";
-  case -45:
-    return "CL_INVALID_PROGRAM_EXECUTABLE";
-  case -46:
-    return "CL_INVALID_KERNEL_NAME";
-  case -47:
-    return "CL_INVALID_KERNEL_DEFINITION";
-  case -48:
-    return "CL_INVALID_KERNEL";
-  case -49:
-    return "CL_INVALID_ARG_INDEX";
-  case -50:
-    return "CL_INVALID_ARG_VALUE";
-  case -51:
-    return "CL_INVALID_ARG_SIZE";
-  case -52:
-    return "CL_INVALID_KERNEL_ARGS";
-  case -53:
-    return "CL_INVALID_WORK_DIMENSION";
-  case -54:
-    return "CL_INVALID_WORK_GROUP_SIZE";
-  case -55:
-    return "CL_INVALID_WORK_ITEM_SIZE";
-  case -56:
-    return "CL_INVALID_GLOBAL_OFFSET";
-  case -57:
-    return "CL_INVALID_EVENT_WAIT_LIST";
-  case -58:
-    return "CL_INVALID_EVENT";
-  case -59:
-    return "CL_INVALID_OPERATION";
-  case -60:
-    return "CL_INVALID_GL_OBJECT";
-  case -61:
-    return "CL_INVALID_BUFFER_SIZE";
-  case -62:
-    return "CL_INVALID_MIP_LEVEL";
-  case -63:
-    return "CL_INVALID_GLOBAL_WORK_SIZE";
-  case -64:
-    return "CL_INVALID_PROPERTY";
-  case -65:
-    return "CL_INVALID_IMAGE_DESCRIPTOR";
-  case -66:
-    return "CL_INVALID_COMPILER_OPTIONS";
-  case -67:
-    return "CL_INVALID_LINKER_OPTIONS";
-  case -68:
-    return "CL_INVALID_DEVICE_PARTITION_COUNT";
-
-  // extension errors
-  case -1000:
-    return "CL_INVALID_GL_SHAREGROUP_REFERENCE_KHR";
-  case -1001:
-    return "CL_PLATFORM_NOT_FOUND_KHR";
-  case -1002:
-    return "CL_INVALID_D3D10_DEVICE_KHR";
-  case -1003:
-    return "CL_INVALID_D3D10_RESOURCE_KHR";
-  case -1004:
-    return "CL_D3D10_RESOURCE_ALREADY_ACQUIRED_KHR";
-  case -1005:
-    return "CL_D3D10_RESOURCE_NOT_ACQUIRED_KHR";
-  default:
-    return "Unknown OpenCL error";
+// initialize values, A & B as streams 0 & 1 of the seed
+void initHostVectors(double *hA, double *hB, size_t n) {
+  randomFill(hA, n, -1.0, 1.0, defaultSeed(), 0, defaultThreads());
+  randomFill(hB, n, -1.0, 1.0, defaultSeed(), 1, defaultThreads());
+}
+
+// set kernel arguments
+cl_int vectorArgs(cl_kernel kernel, cl_mem dA, cl_mem dB, cl_mem dC,
+                  size_t n) {
+  cl_ulong length = n;
+  cl_int err;
+  if ((err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dA)) ||
+      (err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &dB)) ||
+      (err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &dC)) ||
+      (err = clSetKernelArg(kernel, 3, sizeof(length), &length))) {
+    return checkErr(err, "set args");
   }
+  return CL_SUCCESS;
 }
 
-void checkErr(cl_int error, char *success) {
-  if (error != CL_SUCCESS) {
-    printf("%s", getErrorString(error));
-  } else {
-    printf("%s\n", success);
+// queue a vector kernel. the scalar kernels get a work-item per element,
+// rounded up to whole work-groups and bounds checked; the grid-stride ones
+// get a few work-groups per compute unit and loop over the rest. event may
+// be NULL.
+cl_int vectorExec(runtime *rt, cl_command_queue commandQueue, cl_kernel kernel,
+                  size_t n, int gridStride, cl_event *event) {
+  size_t localWorkSize;
+  cl_uint units;
+  cl_event traced;
+  cl_int err;
+  err = clGetKernelWorkGroupInfo(kernel, rt->deviceID,
+                                 CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
+                                 &localWorkSize, NULL);
+  if (checkErr(err, "got work-group size")) {
+    return err;
+  }
+  size_t globalWorkSize = (n + localWorkSize - 1) / localWorkSize;
+  if (gridStride) {
+    err = clGetDeviceInfo(rt->deviceID, CL_DEVICE_MAX_COMPUTE_UNITS,
+                          sizeof(units), &units, NULL);
+    if (checkErr(err, "got compute units")) {
+      return err;
+    }
+    if (globalWorkSize > units * GROUPS_PER_CU) {
+      globalWorkSize = units * GROUPS_PER_CU;
+    }
+  }
+  globalWorkSize *= localWorkSize;
+  err = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalWorkSize,
+                               &localWorkSize, 0, NULL,
+                               event ? event : traceEvent(&traced));
+  if (checkErr(err, "queued kernel")) {
+    return err;
+  }
+  if (event) {
+    traceLaunch(*event, kernel);
+  } else if (traced) {
+    traceRecordLaunch(traced, kernel);
+    clReleaseEvent(traced);
   }
+  return CL_SUCCESS;
 }
 
-// return a random double between 0 and 1
-double randDouble(double min, double max) {
-  double range = max - min;
-  double div = RAND_MAX / range;
-  return min + (rand() / div);
+// wait for a queued kernel, release its event & return its device time
+double kernelTime(cl_event done) {
+  double nanoseconds;
+  clWaitForEvents(1, &done);
+  timeProf(&nanoseconds, done);
+  clReleaseEvent(done);
+  return nanoseconds;
 }
 
-// initialize values
-void initHost(double *hA, double *hB) {
-  for (int i = 0; i < N; i++) {
-    hA[i] = randDouble(-1.0, 1.0);
-    hB[i] = randDouble(-1.0, 1.0);
+// out-of-core C = A op B for arrays bigger than the device. fixed-size chunks
+// go through a ring of RING pooled buffer sets, with the uploads, kernels and
+// downloads on the runtime's three queues chained by events, so chunk i+1
+// uploads while chunk i computes and chunk i-1 downloads. returns the wall
+// time in seconds, or a negative value on failure.
+double streamKernel(runtime *rt, cl_kernel kernel, double *hA, double *hB,
+                    double *hC, size_t n, size_t chunk) {
+  cl_command_queue upQueue = rt->queues[0];
+  cl_command_queue kernelQueue = rt->queues[1];
+  cl_command_queue downQueue = rt->queues[2];
+  cl_mem dA[RING] = {NULL}, dB[RING] = {NULL}, dC[RING] = {NULL};
+  cl_event up[RING] = {NULL}, done[RING] = {NULL}, down[RING] = {NULL};
+  if (chunk > n) {
+    chunk = n;
   }
-  printf("initialized host inputs\n");
-}
+  size_t chunkBytes = chunk * sizeof(double);
+  size_t numChunks = (n + chunk - 1) / chunk;
+  double upTime = 0.0, kernelTotal = 0.0, downTime = 0.0;
+  double nanoseconds;
+  double seconds = -1.0;
+  cl_int err = CL_SUCCESS;
 
-// load kernel from file
-void kernelFromFile(size_t *kernelSize, char *kernelSource, char *filename) {
-  FILE *kernelFile = fopen(filename, "rb");
-  if (!kernelFile) {
-    fprintf(stderr, "kernel file not found.\n");
-    exit(-1);
+  for (int r = 0; r < RING && !err; r++) {
+    if ((err = runtimeBuffer(rt, chunkBytes, CL_MEM_READ_ONLY, &dA[r])) ||
+        (err = runtimeBuffer(rt, chunkBytes, CL_MEM_READ_ONLY, &dB[r])) ||
+        (err = runtimeBuffer(rt, chunkBytes, CL_MEM_WRITE_ONLY, &dC[r]))) {
+      break;
+    }
+  }
+
+  double start = wallTime();
+  for (size_t c = 0; c < numChunks && !err; c++) {
+    int r = c % RING;
+    size_t offset = c * chunk;
+    size_t count = n - offset < chunk ? n - offset : chunk;
+    size_t size = count * sizeof(double);
+
+    // the slot is free again once its previous chunk has been downloaded
+    if (down[r]) {
+      clWaitForEvents(1, &down[r]);
+      timeProf(&nanoseconds, up[r]);
+      upTime += nanoseconds;
+      timeProf(&nanoseconds, done[r]);
+      kernelTotal += nanoseconds;
+      timeProf(&nanoseconds, down[r]);
+      downTime += nanoseconds;
+      clReleaseEvent(up[r]);
+      clReleaseEvent(done[r]);
+      clReleaseEvent(down[r]);
+      up[r] = done[r] = down[r] = NULL;
+    }
+
+    cl_event traced;
+    err = clEnqueueWriteBuffer(upQueue, dA[r], CL_FALSE, 0, size, hA + offset,
+                               0, NULL, traceEvent(&traced));
+    if (checkErr(err, "queued chunk upload of A")) {
+      break;
+    }
+    traceTake(traced, "upload A chunk");
+    err = clEnqueueWriteBuffer(upQueue, dB[r], CL_FALSE, 0, size, hB + offset,
+                               0, NULL, &up[r]);
+    if (checkErr(err, "queued chunk upload of B")) {
+      break;
+    }
+    traceCommand(up[r], "upload B chunk");
+    clFlush(upQueue);
+
+    // exact global size, so the tail chunk never runs past its buffers
+    if ((err = vectorArgs(kernel, dA[r], dB[r], dC[r], count))) {
+      break;
+    }
+    err = clEnqueueNDRangeKernel(kernelQueue, kernel, 1, NULL, &count, NULL, 1,
+                                 &up[r], &done[r]);
+    if (checkErr(err, "queued chunk kernel")) {
+      break;
+    }
+    traceLaunch(done[r], kernel);
+    clFlush(kernelQueue);
+
+    err = clEnqueueReadBuffer(downQueue, dC[r], CL_FALSE, 0, size,
+                              hC + offset, 1, &done[r], &down[r]);
+    if (checkErr(err, "queued chunk download")) {
+      break;
+    }
+    traceCommand(down[r], "download C chunk");
+    clFlush(downQueue);
+  }
+  runtimeFinish(rt);
+  if (!err) {
+    seconds = wallTime() - start;
+  }
+
+  for (int r = 0; r < RING; r++) {
+    if (down[r]) {
+      timeProf(&nanoseconds, up[r]);
+      upTime += nanoseconds;
+      timeProf(&nanoseconds, done[r]);
+      kernelTotal += nanoseconds;
+      timeProf(&nanoseconds, down[r]);
+      downTime += nanoseconds;
+    }
+    if (up[r]) {
+      clReleaseEvent(up[r]);
+    }
+    if (done[r]) {
+      clReleaseEvent(done[r]);
+    }
+    if (down[r]) {
+      clReleaseEvent(down[r]);
+    }
+    runtimeRecycle(rt, dA[r]);
+    runtimeRecycle(rt, dB[r]);
+    runtimeRecycle(rt, dC[r]);
+  }
+  if (err) {
+    return seconds;
   }
-  *kernelSize = fread(kernelSource, 1, MAX_SOURCE_SIZE, kernelFile);
-  fclose(kernelFile);
-  printf("loaded kernel from file\n");
-}
 
-// get platform & device
-void getPlatformDevice(cl_platform_id *platformID, cl_device_id *deviceID) {
-  cl_uint retNumDevices;
-  cl_uint retNumPlatforms;
-  cl_int err = clGetPlatformIDs(1, platformID, &retNumPlatforms);
-  checkErr(err, "got platform");
-  err = clGetDeviceIDs(*platformID, CL_DEVICE_TYPE_GPU, 1, deviceID,
-                       &retNumDevices);
-  checkErr(err, "got device");
+  // the busiest stage bounds the pipeline; the rest should hide behind it
+  printf("streamed %zu chunks of %zu elements in %0.3f ms: %0.2f GB/s\n",
+         numChunks, chunk, seconds * 1000.0,
+         3.0 * n * sizeof(double) / seconds * 1e-9);
+  printf("busy: upload %0.3f ms, kernel %0.3f ms, download %0.3f ms\n",
+         upTime / 1e6, kernelTotal / 1e6, downTime / 1e6);
+  return seconds;
 }
 
-// create context
-void createContext(cl_context *context, cl_device_id *deviceID) {
+//-----------------fused expressions-----------------
+// OUT = expression over the inputs it names, in one fused kernel: each input
+// is read once and OUT written once, with no temporaries in between. the
+// runtime caches the compiled kernel under a hash of its source.
+int runExpr(runtime *rt, const char *text, size_t n) {
+  expr e;
+  char source[8192];
+  if (exprParse(&e, text)) {
+    return 1;
+  }
+  size_t sourceSize = exprKernelSource(&e, source, sizeof(source));
+  if (sourceSize >= sizeof(source)) {
+    fprintf(stderr, "expression too long\n");
+    return 1;
+  }
+
+  cl_program program;
+  cl_kernel kernel;
+  cl_command_queue commandQueue = rt->queues[0];
+  if (runtimeProgramSource(rt, source, sourceSize, &program) ||
+      createKernel(&kernel, &program, EXPR_KERNEL)) {
+    return 1;
+  }
+
+  // random inputs for the letters the expression uses
+  size_t bytes = n * sizeof(double);
+  double *inputs[EXPR_MAX_INPUTS] = {NULL};
+  cl_mem dInputs[EXPR_MAX_INPUTS] = {NULL};
+  double *hOut = (double *)hostAlloc(bytes);
+  cl_mem dOut = NULL;
+  cl_ulong length = n;
+  int numInputs = 0;
+  size_t wrong = 0;
+  cl_event done;
+  double nanoseconds;
   cl_int err;
-  *context = clCreateContext(NULL, 1, deviceID, NULL, NULL, &err);
-  checkErr(err, "created context");
+  if ((err = runtimeBuffer(rt, bytes, CL_MEM_WRITE_ONLY, &dOut)) ||
+      (err = clSetKernelArg(kernel, 0, sizeof(length), &length)) ||
+      (err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &dOut))) {
+    checkErr(err, "set output args");
+    goto cleanup;
+  }
+  for (int v = 0; v < EXPR_MAX_INPUTS; v++) {
+    if (!(e.inputs & (1u << v))) {
+      continue;
+    }
+    inputs[v] = (double *)hostAlloc(bytes);
+    randomFill(inputs[v], n, -1.0, 1.0, defaultSeed(), v, defaultThreads());
+    if ((err = runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dInputs[v])) ||
+        (err = writeBuffer(dInputs[v], inputs[v], bytes, &commandQueue))) {
+      goto cleanup;
+    }
+    err = clSetKernelArg(kernel, 2 + numInputs, sizeof(cl_mem), &dInputs[v]);
+    if (checkErr(err, "set input arg")) {
+      goto cleanup;
+    }
+    numInputs++;
+  }
+
+  // the kernel checks its bounds, so the launch can be left to the runtime
+  err = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &n, NULL, 0,
+                               NULL, &done);
+  if (checkErr(err, "queued kernel")) {
+    goto cleanup;
+  }
+  traceLaunch(done, kernel);
+  if ((err = readBuffer(dOut, hOut, bytes, &commandQueue))) {
+    clReleaseEvent(done);
+    goto cleanup;
+  }
+  nanoseconds = kernelTime(done);
+
+  // check against the host evaluation of the same tree
+  for (size_t i = 0; i < n; i++) {
+    double expected = exprEval(&e, inputs, i);
+    if (fabs(hOut[i] - expected) > 1e-9 * (1.0 + fabs(expected))) {
+      if (wrong++ == 0) {
+        printf("element %zu: got %f, expected %f\n", i, hOut[i], expected);
+      }
+    }
+  }
+  printf("%s over %d inputs: %0.3f ms, %0.2f GB/s, %zu mismatches\n", text,
+         numInputs, nanoseconds / 1e6,
+         (numInputs + 1.0) * bytes / nanoseconds, wrong);
+
+cleanup:
+  for (int v = 0; v < EXPR_MAX_INPUTS; v++) {
+    runtimeRecycle(rt, dInputs[v]);
+    hostFree(inputs[v]);
+  }
+  runtimeRecycle(rt, dOut);
+  clReleaseKernel(kernel);
+  hostFree(hOut);
+  return err != CL_SUCCESS || wrong != 0;
 }
 
-// create command queue
-void createQueue(cl_command_queue *commandQueue, cl_context *context,
-                 cl_device_id *deviceID, int outOfOrder, int profiling) {
-  cl_int err;
-  cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, 0, 0};
-  if (outOfOrder) {
-    props[1] |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+// every reduction in both precisions on the device, against the host
+// threads. bandwidth counts each input element read once. a result further
+// from the host's than the precision's tolerance fails the run.
+int runReduce(runtime *rt, size_t n) {
+  cl_command_queue commandQueue = rt->queues[0];
+  int threads = defaultThreads();
+  int failed = 0, wrong = 0;
+  printf("%zu elements, %d host threads\n", n, threads);
+  printf("%-5s %-6s %12s %12s %10s %6s\n", "op", "type", "device GB/s",
+         "host GB/s", "rel err", "check");
+  for (int isFloat = 0; isFloat < 2 && !failed; isFloat++) {
+    size_t elementSize = isFloat ? sizeof(float) : sizeof(double);
+    size_t bytes = n * elementSize;
+    void *hX = hostAlloc(n * sizeof(double));
+    void *hY = hostAlloc(n * sizeof(double));
+    cl_mem dX = NULL, dY = NULL;
+    reduceKernels kernels;
+    if (!hX || !hY) {
+      fprintf(stderr, "not enough host memory for %zu elements\n", n);
+      hostFree(hX);
+      hostFree(hY);
+      failed = 1;
+      break;
+    }
+    if (reduceKernelsCreate(rt, isFloat, &kernels)) {
+      hostFree(hX);
+      hostFree(hY);
+      failed = 1;
+      break;
+    }
+    randomFill((double *)hX, n, -1.0, 1.0, defaultSeed(), 0, threads);
+    randomFill((double *)hY, n, -1.0, 1.0, defaultSeed(), 1, threads);
+    // narrow in place; float i sits below double i, so nothing unread is lost
+    for (size_t i = 0; isFloat && i < n; i++) {
+      ((float *)hX)[i] = ((double *)hX)[i];
+      ((float *)hY)[i] = ((double *)hY)[i];
+    }
+    if (runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dX) ||
+        runtimeBuffer(rt, bytes, CL_MEM_READ_ONLY, &dY) ||
+        writeBuffer(dX, hX, bytes, &commandQueue) ||
+        writeBuffer(dY, hY, bytes, &commandQueue)) {
+      failed = 1;
+    }
+
+    for (reduceOp op = REDUCE_SUM; op <= REDUCE_AMAX && !failed; op++) {
+      int inputs = op == REDUCE_DOT ? 2 : 1;
+      double device = 0.0, host = 0.0;
+      double best = INFINITY, hostBest = INFINITY;
+      for (int r = 0; r < REDUCE_REPS && !failed; r++) {
+        double nanoseconds;
+        cl_int err = reduceVector(rt, commandQueue, &kernels, op, dX,
+                                  op == REDUCE_DOT ? dY : NULL, n, &device,
+                                  &nanoseconds);
+        if (checkErr(err, reduceName(op))) {
+          failed = 1;
+          break;
+        }
+        best = fmin(best, nanoseconds * 1e-9);
+        double start = wallTime();
+        host = cpuReduce(op, isFloat, hX, op == REDUCE_DOT ? hY : NULL, n,
+                         threads);
+        hostBest = fmin(hostBest, wallTime() - start);
+      }
+      if (failed) {
+        break;
+      }
+      // relative to at least 1, so a sum that cancels is judged absolutely
+      double relErr = fabs(device - host) / fmax(fabs(host), 1.0);
+      int agrees =
+          relErr <= (isFloat ? REDUCE_TOL_FLOAT : REDUCE_TOL_DOUBLE);
+      wrong |= !agrees;
+      printf("%-5s %-6s %12.2f %12.2f %10.2e %6s\n", reduceName(op),
+             isFloat ? "float" : "double", inputs * bytes / best / 1e9,
+             inputs * bytes / hostBest / 1e9, relErr, agrees ? "ok" : "FAIL");
+    }
+    reduceKernelsRelease(&kernels);
+    runtimeRecycle(rt, dX);
+    runtimeRecycle(rt, dY);
+    hostFree(hX);
+    hostFree(hY);
   }
-  if (profiling) {
-    props[1] |= CL_QUEUE_PROFILING_ENABLE;
+  return failed || wrong;
+}
+
+// the scalar kernels against their double4 & double8 grid-stride versions on
+// the same device-resident vectors. each result is checked on the host.
+int compareKernels(runtime *rt, cl_mem dA, cl_mem dB, cl_mem dC, double *hA,
+                   double *hB, double *hC, size_t n) {
+  const char *names[] = {"add", "add4", "add8", "mult", "mult4", "mult8"};
+  cl_command_queue commandQueue = rt->queues[0];
+  size_t bytes = n * sizeof(double);
+  double scalar = 0.0;
+  int failed = 0;
+
+  printf("%-6s %10s %10s %8s\n", "kernel", "ms", "GB/s", "speedup");
+  for (int k = 0; k < 6 && !failed; k++) {
+    int gridStride = k % 3 != 0;
+    int isAdd = k < 3;
+    cl_kernel kernel;
+    if (runtimeKernel(rt, "vector.cl", names[k], &kernel)) {
+      return 1;
+    }
+    double best = INFINITY;
+    for (int r = 0; r < KERNEL_REPS && !failed; r++) {
+      cl_event done;
+      failed = vectorArgs(kernel, dA, dB, dC, n) ||
+               vectorExec(rt, commandQueue, kernel, n, gridStride, &done);
+      best = failed ? best : fmin(best, kernelTime(done));
+    }
+    clReleaseKernel(kernel);
+    if (!gridStride) {
+      scalar = best;
+    }
+
+    if (failed || readBuffer(dC, hC, bytes, &commandQueue)) {
+      return 1;
+    }
+    size_t wrong = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (hC[i] != (isAdd ? hA[i] + hB[i] : hA[i] * hB[i])) {
+        wrong++;
+      }
+    }
+    printf("%-6s %10.3f %10.2f %7.2fx", names[k], best / 1e6,
+           3.0 * bytes / best, scalar / best);
+    if (wrong) {
+      printf(" %zu wrong", wrong);
+      failed = 1;
+    }
+    printf("\n");
   }
-  *commandQueue =
-      clCreateCommandQueueWithProperties(*context, *deviceID, props, &err);
-  checkErr(err, "created command queue");
+  return failed;
 }
 
-// create memory buffers
-void createBuffer(cl_mem *deviceBuffer, int direction, cl_context *context) {
-  cl_int err;
-  *deviceBuffer = clCreateBuffer(
-      *context, direction, N * sizeof(double), NULL,
-      &err); // for flags: direction will be 1(output) or 2(input).
-  checkErr(err, "created buffer");
+// STREAM copy, scale, add & triad on the host threads and on the device, for
+// the sustainable bandwidth of each. bytes moved count every array read or
+// written once, as STREAM does.
+int runStream(runtime *rt, cl_mem dA, cl_mem dB, cl_mem dC, double *hA,
+              double *hB, double *hC, size_t n) {
+  const char *names[] = {"copy", "scale", "add", "triad"};
+  const vectorOp ops[] = {VECTOR_COPY, VECTOR_SCALE, VECTOR_ADD, VECTOR_TRIAD};
+  const int arrays[] = {2, 2, 3, 3};
+  cl_command_queue commandQueue = rt->queues[0];
+  size_t bytes = n * sizeof(double);
+  double s = STREAM_SCALAR;
+  int threads = defaultThreads();
+  int failed = 0;
+  double *check = (double *)hostAlloc(bytes);
+
+  printf("%zu elements, %d host threads, %s host stores\n", n, threads,
+         bytes > llcBytes() ? "streaming" : "cached");
+  printf("%-6s %12s %12s\n", "op", "host GB/s", "device GB/s");
+  for (int k = 0; k < 4 && !failed; k++) {
+    double hostBest = INFINITY, deviceBest = INFINITY;
+    for (int r = 0; r < KERNEL_REPS; r++) {
+      double start = wallTime();
+      cpuVectorOp(ops[k], hC, hA, hB, s, n, threads);
+      hostBest = fmin(hostBest, wallTime() - start);
+    }
+
+    cl_kernel kernel;
+    if (runtimeKernel(rt, "vector.cl", names[k], &kernel)) {
+      failed = 1;
+      break;
+    }
+    failed = vectorArgs(kernel, dA, dB, dC, n) != CL_SUCCESS;
+    if (!failed && (ops[k] == VECTOR_SCALE || ops[k] == VECTOR_TRIAD)) {
+      cl_int err = clSetKernelArg(kernel, 4, sizeof(s), &s);
+      failed = checkErr(err, "set arg 5") != CL_SUCCESS;
+    }
+    for (int r = 0; r < KERNEL_REPS && !failed; r++) {
+      cl_event done;
+      failed = vectorExec(rt, commandQueue, kernel, n, 0, &done) != CL_SUCCESS;
+      deviceBest = failed ? deviceBest : fmin(deviceBest, kernelTime(done));
+    }
+    clReleaseKernel(kernel);
+
+    // the host result is in hC; the device may contract triad into an fma
+    if (failed || readBuffer(dC, check, bytes, &commandQueue)) {
+      failed = 1;
+      break;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (fabs(check[i] - hC[i]) > 1e-12 * (1.0 + fabs(hC[i]))) {
+        printf("%s: element %zu is %f on the device, %f on the host\n",
+               names[k], i, check[i], hC[i]);
+        failed = 1;
+        break;
+      }
+    }
+
+    printf("%-6s %12.2f %12.2f\n", names[k],
+           arrays[k] * bytes / hostBest * 1e-9,
+           arrays[k] * bytes / deviceBest);
+  }
+  hostFree(check);
+  return failed;
 }
 
-// copy host vectors to device
-void cpyHostToDevice(cl_mem dest, double *source,
-                     cl_command_queue *commandQueue) {
+// A & B made by philox.cl straight into device memory, no upload. the host
+// already holds the same values, so A is read back into scratch & compared
+// bit for bit.
+cl_int generateInputs(runtime *rt, cl_mem dA, cl_mem dB, double *hA,
+                      double *scratch, size_t n) {
+  cl_command_queue commandQueue = rt->queues[0];
+  cl_program program;
+  cl_event made[2];
+  double total;
   cl_int err;
-  err = clEnqueueWriteBuffer(*commandQueue, dest, CL_TRUE, 0,
-                             N * sizeof(double), source, 0, NULL, NULL);
-  checkErr(err, "copied host to device");
+  if ((err = runtimeProgram(rt, "philox.cl", &program))) {
+    return err;
+  }
+  err = randomFillDevice(commandQueue, program, dA, n, -1.0, 1.0,
+                         defaultSeed(), 0, &made[0]);
+  if (checkErr(err, "generated A on device")) {
+    return err;
+  }
+  err = randomFillDevice(commandQueue, program, dB, n, -1.0, 1.0,
+                         defaultSeed(), 1, &made[1]);
+  if (checkErr(err, "generated B on device")) {
+    clReleaseEvent(made[0]);
+    return err;
+  }
+  total = kernelTime(made[0]) + kernelTime(made[1]);
+
+  if ((err = readBuffer(dA, scratch, n * sizeof(double), &commandQueue))) {
+    return err;
+  }
+  printf("generated inputs in %0.3f ms (%0.2f GB/s), %s the host's\n",
+         total / 1e6, 2.0 * n * sizeof(double) / total,
+         memcmp(scratch, hA, n * sizeof(double)) ? "DIFFERENT from"
+                                                  : "bit identical to");
+  return CL_SUCCESS;
 }
 
-// create program from kernel source
-void createProgramFromSource(cl_program *program, cl_context *context,
-                             const char *kernelSource, size_t *kernelSize) {
-  cl_int err;
-  *program =
-      clCreateProgramWithSource(*context, 1, &kernelSource, kernelSize, &err);
-  checkErr(err, "created program from source");
+// device prefix sums against the host threads over lengths from
+// SCAN_SWEEP_MIN up to n, four times longer each step. both the inclusive
+// and exclusive device results are checked; the inclusive one is timed.
+// bandwidth counts the input read & output written once.
+int runScan(runtime *rt, size_t n) {
+  cl_command_queue commandQueue = rt->queues[0];
+  int threads = defaultThreads();
+  int failed = 0;
+  printf("%d host threads\n", threads);
+  printf("%12s %-6s %12s %12s %6s\n", "n", "type", "device GB/s",
+         "host GB/s", "check");
+  for (int isInt = 0; isInt < 2 && !failed; isInt++) {
+    size_t elementSize = isInt ? sizeof(int) : sizeof(double);
+    double *hIn = (double *)hostAlloc(n * sizeof(double));
+    void *hOut = hostAlloc(n * elementSize);
+    void *hRef = hostAlloc(n * elementSize);
+    cl_mem dIn = NULL, dOut = NULL;
+    scanKernels kernels;
+    if (!hIn || !hOut || !hRef) {
+      fprintf(stderr, "not enough host memory for %zu elements\n", n);
+      hostFree(hIn);
+      hostFree(hOut);
+      hostFree(hRef);
+      failed = 1;
+      break;
+    }
+    if (scanKernelsCreate(rt, isInt, &kernels)) {
+      hostFree(hIn);
+      hostFree(hOut);
+      hostFree(hRef);
+      failed = 1;
+      break;
+    }
+    // ints are small, so sums of 2^27 of them still fit
+    randomFill(hIn, n, isInt ? 0.0 : -1.0, isInt ? 10.0 : 1.0, defaultSeed(),
+               0, threads);
+    for (size_t i = 0; isInt && i < n; i++) {
+      ((int *)hIn)[i] = (int)hIn[i];
+    }
+    if (runtimeBuffer(rt, n * elementSize, CL_MEM_READ_ONLY, &dIn) ||
+        runtimeBuffer(rt, n * elementSize, CL_MEM_READ_WRITE, &dOut) ||
+        writeBuffer(dIn, hIn, n * elementSize, &commandQueue)) {
+      failed = 1;
+    }
+
+    for (size_t len = SCAN_SWEEP_MIN < n ? SCAN_SWEEP_MIN : n; !failed;
+         len = len * 4 < n ? len * 4 : n) {
+      size_t bytes = len * elementSize;
+      double best = INFINITY, hostBest = INFINITY;
+      size_t wrong = 0;
+      for (int inclusive = 0; inclusive < 2 && !failed; inclusive++) {
+        for (int r = 0; r < (inclusive ? KERNEL_REPS : 1); r++) {
+          double nanoseconds;
+          cl_int err = scanVector(rt, commandQueue, &kernels, inclusive, dIn,
+                                  dOut, len, &nanoseconds);
+          if (checkErr(err, "scan")) {
+            failed = 1;
+            break;
+          }
+          best = inclusive ? fmin(best, nanoseconds * 1e-9) : best;
+        }
+        for (int r = 0; r < (inclusive ? KERNEL_REPS : 1); r++) {
+          double start = wallTime();
+          cpuScan(isInt, inclusive, hIn, hRef, len, threads);
+          hostBest = inclusive ? fmin(hostBest, wallTime() - start) : hostBest;
+        }
+        if (failed || readBuffer(dOut, hOut, bytes, &commandQueue)) {
+          failed = 1;
+          break;
+        }
+        // double sums are added in a different order on the device
+        for (size_t i = 0; i < len; i++) {
+          if (isInt ? ((int *)hOut)[i] != ((int *)hRef)[i]
+                    : fabs(((double *)hOut)[i] - ((double *)hRef)[i]) >
+                          1e-9 * (i + 1)) {
+            wrong++;
+          }
+        }
+      }
+      if (failed) {
+        break;
+      }
+      printf("%12zu %-6s %12.2f %12.2f %6s\n", len, isInt ? "int" : "double",
+             2.0 * bytes / best * 1e-9, 2.0 * bytes / hostBest * 1e-9,
+             wrong ? "FAIL" : "ok");
+      failed |= wrong != 0;
+      if (len == n) {
+        break;
+      }
+    }
+    scanKernelsRelease(&kernels);
+    runtimeRecycle(rt, dIn);
+    runtimeRecycle(rt, dOut);
+    hostFree(hIn);
+    hostFree(hOut);
+    hostFree(hRef);
+  }
+  return failed;
 }
 
-// build program
-void buildProgram(cl_program *program, cl_device_id *deviceID) {
-  cl_int err;
-  err = clBuildProgram(*program, 1, deviceID, NULL, NULL, NULL);
-  checkErr(err, "built program");
+// largest difference between two arrays, relative to the expected one
+double maxError(const double *got, const double *expected, size_t n) {
+  double worst = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    worst = fmax(worst, fabs(got[i] - expected[i]) / (1.0 + fabs(expected[i])));
+  }
+  return worst;
 }
 
-// create kernel
-void createKernel(cl_kernel *kernel, cl_program *program, char *funcName) {
-  cl_int err;
-  *kernel = clCreateKernel(*program, funcName, &err);
-  checkErr(err, "created kernel");
+void stridedReport(const char *what, cl_event done, double bytes,
+                   double error) {
+  double nanoseconds = kernelTime(done);
+  printf("%-28s %10.3f %10.2f %10.2e\n", what, nanoseconds / 1e6,
+         bytes / nanoseconds, error);
 }
 
-// set kernel arguments
-void setArgs(cl_kernel *kernel, cl_mem dA, cl_mem dB, cl_mem dC) {
+// strided & broadcast ops on an m x m column-major matrix M, m = sqrt(n),
+// and a vector v, all resident on the device. each is checked against the
+// host doing the same on its copies.
+int runStrided(runtime *rt, size_t n) {
+  size_t m = (size_t)sqrt((double)n);
+  size_t bytes = m * m * sizeof(double);
+  cl_command_queue commandQueue = rt->queues[0];
+  cl_kernel kernel;
+  if (runtimeKernel(rt, "vector.cl", "strided", &kernel)) {
+    return 1;
+  }
+
+  double *hM = (double *)hostAlloc(bytes);
+  double *hZ = (double *)hostAlloc(bytes);
+  double *check = (double *)hostAlloc(bytes);
+  double *hv = (double *)hostAlloc(m * sizeof(double));
+  randomFill(hM, m * m, -1.0, 1.0, defaultSeed(), 0, defaultThreads());
+  randomFill(hv, m, -1.0, 1.0, defaultSeed(), 1, defaultThreads());
+  cl_mem dM = NULL, dZ = NULL, dv = NULL;
+  double worst = INFINITY, error;
+  cl_event done;
   cl_int err;
-  err = clSetKernelArg(*kernel, 0, sizeof(cl_mem), (void *)&dA);
-  checkErr(err, "set arg 1");
-  err = clSetKernelArg(*kernel, 1, sizeof(cl_mem), (void *)&dB);
-  checkErr(err, "set arg 2");
-  err = clSetKernelArg(*kernel, 2, sizeof(cl_mem), (void *)&dC);
-  checkErr(err, "set arg 3");
+  if ((err = runtimeBuffer(rt, bytes, CL_MEM_READ_WRITE, &dM)) ||
+      (err = runtimeBuffer(rt, bytes, CL_MEM_WRITE_ONLY, &dZ)) ||
+      (err = runtimeBuffer(rt, m * sizeof(double), CL_MEM_READ_WRITE, &dv)) ||
+      (err = writeBuffer(dM, hM, bytes, &commandQueue)) ||
+      (err = writeBuffer(dv, hv, m * sizeof(double), &commandQueue))) {
+    goto cleanup;
+  }
+
+  worst = 0.0;
+  printf("%zu x %zu matrix\n", m, m);
+  printf("%-28s %10s %10s %10s\n", "op", "ms", "GB/s", "max err");
+
+  // v = 2 * (row m / 2 of M) + v, reading the row ld apart
+  size_t row = m / 2, col = m / 3;
+  err = stridedAxpy(commandQueue, kernel, m, 2.0, viewVector(dM, row, m),
+                    viewVector(dv, 0, 1), &done);
+  if (checkErr(err, "queued axpy")) {
+    goto cleanup;
+  }
+  for (size_t i = 0; i < m; i++) {
+    hv[i] += 2.0 * hM[row + i * m];
+  }
+  if ((err = readBuffer(dv, check, m * sizeof(double), &commandQueue))) {
+    goto cleanup;
+  }
+  error = maxError(check, hv, m);
+  stridedReport("axpy, x a matrix row", done, 3.0 * m * sizeof(double),
+                error);
+  worst = fmax(worst, error);
+
+  // column m / 3 of M halved in place
+  err = stridedScal(commandQueue, kernel, m, 0.5, viewVector(dM, col * m, 1),
+                    &done);
+  if (checkErr(err, "queued scal")) {
+    goto cleanup;
+  }
+  for (size_t i = 0; i < m; i++) {
+    hM[col * m + i] *= 0.5;
+  }
+  if ((err = readBuffer(dM, check, bytes, &commandQueue))) {
+    goto cleanup;
+  }
+  error = maxError(check, hM, m * m);
+  stridedReport("scal, a matrix column", done, 2.0 * m * sizeof(double),
+                error);
+  worst = fmax(worst, error);
+
+  // Z = M + v, v added to every row
+  err = stridedApply(commandQueue, kernel, STRIDED_ADD, 1.0, m, m,
+                     viewMatrix(dM, 0, m), viewRow(dv, 0, 1),
+                     viewMatrix(dZ, 0, m), &done);
+  if (checkErr(err, "queued row broadcast")) {
+    goto cleanup;
+  }
+  for (size_t c = 0; c < m; c++) {
+    for (size_t r = 0; r < m; r++) {
+      hZ[r + c * m] = hM[r + c * m] + hv[c];
+    }
+  }
+  if ((err = readBuffer(dZ, check, bytes, &commandQueue))) {
+    goto cleanup;
+  }
+  error = maxError(check, hZ, m * m);
+  stridedReport("M + row broadcast", done, 2.0 * bytes, error);
+  worst = fmax(worst, error);
+
+  // Z = M * v, every column scaled elementwise by v
+  err = stridedApply(commandQueue, kernel, STRIDED_MULT, 1.0, m, m,
+                     viewMatrix(dM, 0, m), viewVector(dv, 0, 1),
+                     viewMatrix(dZ, 0, m), &done);
+  if (checkErr(err, "queued column broadcast")) {
+    goto cleanup;
+  }
+  for (size_t c = 0; c < m; c++) {
+    for (size_t r = 0; r < m; r++) {
+      hZ[r + c * m] = hM[r + c * m] * hv[r];
+    }
+  }
+  if ((err = readBuffer(dZ, check, bytes, &commandQueue))) {
+    goto cleanup;
+  }
+  error = maxError(check, hZ, m * m);
+  stridedReport("M * column broadcast", done, 2.0 * bytes, error);
+  worst = fmax(worst, error);
+
+cleanup:
+  runtimeRecycle(rt, dM);
+  runtimeRecycle(rt, dZ);
+  runtimeRecycle(rt, dv);
+  clReleaseKernel(kernel);
+  hostFree(hM);
+  hostFree(hZ);
+  hostFree(check);
+  hostFree(hv);
+  return err != CL_SUCCESS || worst > 1e-12;
 }
 
-// execute kernel
-void execKernel(cl_device_id deviceID, cl_command_queue *commandQueue,
-                cl_kernel *kernel, cl_event *event) {
-  size_t localWorkSize;
+// C = A + B on the device: upload, kernel & download through the runtime.
+// buffers come from its pool & go back to it, so only the first call pays
+// for creating them and building vector.cl. *nanoseconds gets the kernel
+// time; deviceRand makes A & B on the device instead of uploading them.
+cl_int deviceAdd(runtime *rt, double *hA, double *hB, double *hC, size_t n,
+                 int deviceRand, double *nanoseconds) {
+  cl_command_queue commandQueue = rt->queues[0];
+  size_t bytes = n * sizeof(double);
+  cl_mem dA = NULL, dB = NULL, dC = NULL;
+  cl_mem_flags inputFlags = deviceRand ? CL_MEM_READ_WRITE : CL_MEM_READ_ONLY;
+  cl_kernel kernel = NULL;
+  cl_event done;
   cl_int err;
-  err = clGetDeviceInfo(deviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t),
-                        (void *)&localWorkSize, NULL);
-  printf("using device max work group size of %d\n", localWorkSize);
-  checkErr(err, "work size set");
-  size_t globalWorkSize =
-      ceil(N / (float)localWorkSize) *
-      localWorkSize; // 134 million global items to calculate
-  err = clEnqueueNDRangeKernel(*commandQueue, *kernel, 1, NULL, &globalWorkSize,
-                               &localWorkSize, 0, NULL, event);
-  checkErr(err, "kernel executed");
-  err = clWaitForEvents(1, event);
-  checkErr(err, "finished execution");
+  if ((err = runtimeKernel(rt, "vector.cl", "add", &kernel)) ||
+      (err = runtimeBuffer(rt, bytes, inputFlags, &dA)) ||
+      (err = runtimeBuffer(rt, bytes, inputFlags, &dB)) ||
+      (err = runtimeBuffer(rt, bytes, CL_MEM_WRITE_ONLY, &dC))) {
+    goto cleanup;
+  }
+  if (deviceRand) {
+    err = generateInputs(rt, dA, dB, hA, hC, n);
+  } else {
+    // copy host vectors to device
+    cl_event traced;
+    err = clEnqueueWriteBuffer(commandQueue, dA, CL_FALSE, 0, bytes, hA, 0,
+                               NULL, traceEvent(&traced));
+    traceTake(err ? NULL : traced, "upload A");
+    if (!err) {
+      err = clEnqueueWriteBuffer(commandQueue, dB, CL_FALSE, 0, bytes, hB, 0,
+                                 NULL, traceEvent(&traced));
+      traceTake(err ? NULL : traced, "upload B");
+    }
+    checkErr(err, "queued uploads");
+  }
+  if (err || (err = vectorArgs(kernel, dA, dB, dC, n)) ||
+      (err = vectorExec(rt, commandQueue, kernel, n, 0, &done))) {
+    goto cleanup;
+  }
+  // read device vectors to host
+  err = readBuffer(dC, hC, bytes, &commandQueue);
+  *nanoseconds = kernelTime(done);
+
+cleanup:
+  runtimeRecycle(rt, dA);
+  runtimeRecycle(rt, dB);
+  runtimeRecycle(rt, dC);
+  if (kernel) {
+    clReleaseKernel(kernel);
+  }
+  return err;
 }
 
-// read device vectors back to host
-void readDeviceToHost(cl_mem source, double *dest,
-                      cl_command_queue *commandQueue) {
-  cl_int err;
-  err = clEnqueueReadBuffer(*commandQueue, source, CL_TRUE, 0,
-                            N * sizeof(double), (void *)dest, 0, NULL, NULL);
+// the whole add repeated through the runtime: the first pass builds or loads
+// vector.cl and creates the buffers, later ones find both ready
+int runRepeat(runtime *rt, double *hA, double *hB, double *hC, size_t n,
+              int repeats) {
+  double first = 0.0, rest = 0.0, nanoseconds;
+  for (int r = 0; r < repeats; r++) {
+    double start = wallTime();
+    if (deviceAdd(rt, hA, hB, hC, n, 0, &nanoseconds)) {
+      return 1;
+    }
+    double seconds = wallTime() - start;
+    if (r == 0) {
+      first = seconds;
+    } else {
+      rest += seconds;
+    }
+  }
+  printf("first add %0.3f ms", first * 1e3);
+  if (repeats > 1) {
+    printf(", then %0.3f ms each (%0.2f GB/s with copies)",
+           rest / (repeats - 1) * 1e3,
+           3.0 * n * sizeof(double) * (repeats - 1) / rest * 1e-9);
+  }
+  printf("\nprograms: %d built, %d from the binary cache; buffers: %d "
+         "created, %d reused\n",
+         rt->programsBuilt, rt->programsLoaded, rt->buffersCreated,
+         rt->buffersReused);
+  return 0;
+}
+
+static volatile double pageSink; // keeps the walk's reads alive
+
+// triad & a page walk over the same arrays on 4 KiB, transparent huge and
+// explicit huge pages. the walk reads one double from every 4 KiB page in a
+// scattered order, so nearly every read needs a fresh TLB entry on small
+// pages; its ns per read shows the page walks that huge pages save.
+int runPages(size_t n) {
+  size_t bytes = n * sizeof(double);
+  size_t numPages = bytes / 4096;
+  int threads = defaultThreads();
+  printf("%zu elements, %d host threads\n", n, threads);
+  printf("%-17s %10s %12s %14s\n", "pages", "huge MiB", "triad GB/s",
+         "walk ns/read");
+  for (hostPages pages = PAGES_SMALL; pages <= PAGES_EXPLICIT; pages++) {
+    size_t before = hugeBytes();
+    setHostPages(pages);
+    double *hA = (double *)hostAlloc(bytes);
+    double *hB = (double *)hostAlloc(bytes);
+    double *hC = (double *)hostAlloc(bytes);
+    if (!hA || !hB || !hC) {
+      fprintf(stderr, "not enough host memory for %zu elements\n", n);
+      hostFree(hA);
+      hostFree(hB);
+      hostFree(hC);
+      return 1;
+    }
+    initHostVectors(hA, hB, n);
+    cpuVectorOp(VECTOR_COPY, hC, hA, hB, 0.0, n, threads);
+    size_t huge = hugeBytes() - before;
+
+    double best = INFINITY;
+    for (int r = 0; r < KERNEL_REPS; r++) {
+      double start = wallTime();
+      cpuVectorOp(VECTOR_TRIAD, hC, hA, hB, STREAM_SCALAR, n, threads);
+      best = fmin(best, wallTime() - start);
+    }
+
+    // one thread, as each core has its own TLB
+    double walk = INFINITY, sum = 0.0;
+    for (int r = 0; r < KERNEL_REPS && numPages > 0; r++) {
+      size_t page = 0;
+      double start = wallTime();
+      for (size_t i = 0; i < numPages; i++) {
+        page = (page + PAGE_WALK_STRIDE) % numPages;
+        sum += hA[page * 512 + (i & 511)];
+      }
+      walk = fmin(walk, wallTime() - start);
+    }
+    printf("%-17s %10.1f %12.2f %14.2f\n", pagesName(pages), huge / 1048576.0,
+           3.0 * bytes / best * 1e-9, walk / numPages * 1e9);
+    pageSink = sum;
+    hostFree(hA);
+    hostFree(hB);
+    hostFree(hC);
+  }
+  return 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -347,93 +984,136 @@ int main(int argc, char *argv[]) {
   // setup randomization & error return variable
   time_t t;
   srand((unsigned)time(&t));
-  cl_int ret;
+
+  // --n sets the vector length, --chunk <MiB> streams the vectors through
+  // the device in chunks of that size instead of copying them whole, --expr
+  // evaluates an expression over inputs A-H in one fused kernel, --reduce
+  // benchmarks the device reductions against the host threads, --compare
+  // times the scalar kernels against the grid-stride double4/double8 ones,
+  // --stream reports STREAM bandwidth on the host threads and the device,
+  // --device-rand generates A & B in device memory instead of copying them,
+  // --scan sweeps the prefix sums up to --n on the device & host threads,
+  // --strided runs axpy, scal & broadcasts over views of a resident matrix,
+  // --repeat <k> times k adds through the runtime's program cache & pool,
+  // --pages compares host bandwidth & TLB reach on small and huge pages
+  size_t n = VECTOR_N;
+  size_t chunkMiB = 0;
+  const char *exprText = NULL;
+  int reduce = 0;
+  int compare = 0;
+  int stream = 0;
+  int deviceRand = 0;
+  int scan = 0;
+  int strided = 0;
+  int repeats = 0;
+  int pages = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--n") && i + 1 < argc) {
+      n = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--chunk") && i + 1 < argc) {
+      chunkMiB = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--expr") && i + 1 < argc) {
+      exprText = argv[++i];
+    } else if (!strcmp(argv[i], "--reduce")) {
+      reduce = 1;
+    } else if (!strcmp(argv[i], "--compare")) {
+      compare = 1;
+    } else if (!strcmp(argv[i], "--stream")) {
+      stream = 1;
+    } else if (!strcmp(argv[i], "--device-rand")) {
+      deviceRand = 1;
+    } else if (!strcmp(argv[i], "--scan")) {
+      scan = 1;
+    } else if (!strcmp(argv[i], "--strided")) {
+      strided = 1;
+    } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+      repeats = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--pages")) {
+      pages = 1;
+    } else if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+      setDeviceSpec(argv[++i]);
+    }
+  }
+  if (n == 0) {
+    fprintf(stderr, "vector length must be positive\n");
+    return 1;
+  }
+  if (pages) {
+    return runPages(n);
+  }
+
+  // one device, context, program cache & buffer pool for whatever runs
+  runtime rt;
+  if (runtimeInit(&rt, NULL)) {
+    return 1;
+  }
+  if (exprText || reduce || scan || strided) {
+    int failed = exprText ? runExpr(&rt, exprText, n)
+                 : reduce ? runReduce(&rt, n)
+                 : scan   ? runScan(&rt, n)
+                          : runStrided(&rt, n);
+    runtimeShutdown(&rt);
+    return failed;
+  }
 
   // host arrays
-  int bytes = N * sizeof(double);
-  double *hA = (double *)malloc(bytes);
-  double *hB = (double *)malloc(bytes);
-  double *hC = (double *)malloc(bytes);
-  int i;
+  size_t bytes = n * sizeof(double);
+  double *hA = (double *)hostAlloc(bytes);
+  double *hB = (double *)hostAlloc(bytes);
+  double *hC = (double *)hostAlloc(bytes);
   double nanoseconds = 0.0;
+  if (!hA || !hB || !hC) {
+    fprintf(stderr, "not enough host memory for %zu elements\n", n);
+    runtimeShutdown(&rt);
+    return 1;
+  }
 
   // initialize values
-  initHost(hA, hB);
-
-  // load kernel from file
-  char *kernelSource = (char *)malloc(MAX_SOURCE_SIZE);
-  size_t kernelSize;
-  kernelFromFile(&kernelSize, kernelSource, "vector.cl");
-
-  // get platform & device
-  cl_platform_id platformID = NULL;
-  cl_device_id deviceID = NULL;
-  getPlatformDevice(&platformID, &deviceID);
-
-  // create context
-  cl_context context;
-  createContext(&context, &deviceID);
-
-  // create command queue
-  cl_command_queue commandQueue;
-  createQueue(&commandQueue, &context, &deviceID, 1, 1);
-
-  // memory buffers
-  cl_mem dA, dB, dC;
-  createBuffer(&dA, CL_MEM_READ_ONLY, &context);
-  createBuffer(&dB, CL_MEM_READ_ONLY, &context);
-  createBuffer(&dC, CL_MEM_WRITE_ONLY, &context);
-  // copy host vectors to device
-  cpyHostToDevice(dA, hA, &commandQueue);
-  cpyHostToDevice(dB, hB, &commandQueue);
-
-  // create program from kernel source
-  cl_program program;
-  createProgramFromSource(&program, &context, kernelSource, &kernelSize);
-
-  // build program
-  buildProgram(&program, &deviceID);
+  initHostVectors(hA, hB, n);
 
-  // create kernel
-  cl_kernel kernel;
-  createKernel(&kernel, &program, "add");
-
-  // set kernel arguments
-  setArgs(&kernel, dA, dB, dC);
-
-  // execute kernel
-  cl_event done; // profiling flag
-  execKernel(deviceID, &commandQueue, &kernel, &done);
-  // read device vectors to host
-  readDeviceToHost(dC, hC, &commandQueue);
-  ret = clFinish(commandQueue);
-  checkErr(ret, "finished queue");
-
-  // profiling
-  cl_ulong timeStart;
-  cl_ulong timeEnd;
-  clGetEventProfilingInfo(done, CL_PROFILING_COMMAND_START, sizeof(timeStart),
-                          &timeStart, NULL);
-  clGetEventProfilingInfo(done, CL_PROFILING_COMMAND_END, sizeof(timeEnd),
-                          &timeEnd, NULL);
-  nanoseconds = timeEnd - timeStart;
+  int failed = 0;
+  if (compare || stream) {
+    // inputs stay resident across every kernel timed
+    cl_mem dA = NULL, dB = NULL, dC = NULL;
+    failed = runtimeBuffer(&rt, bytes, CL_MEM_READ_ONLY, &dA) ||
+             runtimeBuffer(&rt, bytes, CL_MEM_READ_ONLY, &dB) ||
+             runtimeBuffer(&rt, bytes, CL_MEM_WRITE_ONLY, &dC) ||
+             writeBuffer(dA, hA, bytes, &rt.queues[0]) ||
+             writeBuffer(dB, hB, bytes, &rt.queues[0]);
+    if (!failed) {
+      failed = compare ? compareKernels(&rt, dA, dB, dC, hA, hB, hC, n)
+                       : runStream(&rt, dA, dB, dC, hA, hB, hC, n);
+    }
+    runtimeRecycle(&rt, dA);
+    runtimeRecycle(&rt, dB);
+    runtimeRecycle(&rt, dC);
+  } else if (repeats > 0) {
+    failed = runRepeat(&rt, hA, hB, hC, n, repeats);
+  } else if (chunkMiB > 0) {
+    size_t chunk = chunkMiB * 1024 * 1024 / sizeof(double);
+    cl_kernel kernel;
+    failed = runtimeKernel(&rt, "vector.cl", "add", &kernel) != CL_SUCCESS;
+    if (!failed) {
+      double seconds = streamKernel(&rt, kernel, hA, hB, hC, n, chunk);
+      failed = seconds < 0.0;
+      nanoseconds = seconds * 1e9;
+      clReleaseKernel(kernel);
+    }
+  } else {
+    failed =
+        deviceAdd(&rt, hA, hB, hC, n, deviceRand, &nanoseconds) != CL_SUCCESS;
+  }
 
   // verify answer
-  cpuBench(hA, hB);
-  gpuBench(hA, hB, hC, nanoseconds);
-
-  ret = clFlush(commandQueue);
-  ret = clReleaseCommandQueue(commandQueue);
-  ret = clReleaseKernel(kernel);
-  ret = clReleaseProgram(program);
-  ret = clReleaseMemObject(dA);
-  ret = clReleaseMemObject(dB);
-  ret = clReleaseMemObject(dC);
-  ret = clReleaseContext(context);
-  free(hA);
-  free(hB);
-  free(hC);
-  free(kernelSource);
+  if (!failed && !compare && !stream && !repeats) {
+    vectorCpuBench(hA, hB, n);
+    vectorGpuBench(hA, hB, hC, n, nanoseconds);
+  }
 
-  return 0;
-}
\ No newline at end of file
+  runtimeShutdown(&rt);
+  hostFree(hA);
+  hostFree(hB);
+  hostFree(hC);
+
+  return failed;
+}